@@ -0,0 +1,532 @@
+#include "cchtml.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+/// Summary
+///  Reproducible pseudo random numbers, the same on every platform
+///
+class bench_random {
+public:
+    bench_random() : _state(0x853c49e6748fea9bull) {}
+
+    uint64_t next() {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return _state;
+    }
+
+    size_t below(size_t n) { return (size_t)(next() % n); }
+
+private:
+    uint64_t _state;
+};
+
+std::string name_of(const char* prefix, size_t n) {
+    char text[32];
+    sprintf(text, "%s%u", prefix, (unsigned)n);
+    return text;
+}
+
+/// Summary
+///  Huge comment blocks with a little code between them
+///
+void gen_comment_blocks(std::string& out, size_t size, bench_random& rnd) {
+    static const char* const words[] = {
+        "the", "index", "of", "class", "enum", "returns", "value", "struct",
+        "\"quoted\"", "it's", "<tag>", "a&b", "/*", "TODO:", "namespace", "int"
+    };
+
+    for (size_t n = 0; out.size() < size; ++n) {
+        out += "/*\n";
+        for (size_t line = 0; line < 1000; ++line) {
+            out += " *";
+            for (size_t w = 0; w < 10; ++w) {
+                out += ' ';
+                out += words[rnd.below(sizeof(words) / sizeof(words[0]))];
+            }
+            out += '\n';
+        }
+        out += " */\n";
+        for (size_t line = 0; line < 100; ++line) {
+            out += "// line comment with a \"string\" and 'c' inside\n";
+        }
+        out += "int " + name_of("commented_", n) + "(int x) { return x; }\n";
+    }
+}
+
+/// Summary
+///  Namespaces and classes nested hundreds of levels deep
+///
+void gen_namespace_nesting(std::string& out, size_t size, bench_random& rnd) {
+    const size_t depth = 200;
+    for (size_t n = 0; out.size() < size; ++n) {
+        std::string scope;
+        for (size_t d = 0; d < depth; ++d) {
+            std::string ns = name_of("ns", d);
+            out.append(d, ' ');
+            out += "namespace " + ns + " {\n";
+            out.append(d, ' ');
+            out += "class " + name_of("Type", d) + " { public: int get() const; };\n";
+            scope += ns + "::";
+        }
+
+        for (size_t d = 0; d < depth; ++d) {
+            out += scope + name_of("Type", rnd.below(depth)) + " " + name_of("v", d) + ";\n";
+        }
+
+        for (size_t d = depth; d > 0; --d) {
+            out.append(d - 1, ' ');
+            out += "}\n";
+        }
+        out += "int " + name_of("nested_", n) + "();\n";
+    }
+}
+
+/// Summary
+///  Thousands of enumerations and references to their constants
+///
+void gen_enums(std::string& out, size_t size, bench_random& rnd) {
+    for (size_t n = 0; out.size() < size; ++n) {
+        std::string type = name_of("Enum", n);
+        out += (n % 2 ? "enum class " : "enum ") + type + " {\n";
+        size_t count = 4 + rnd.below(60);
+        for (size_t i = 0; i < count; ++i) {
+            out += "    " + name_of("k", n) + name_of("_", i) + " = " + name_of("", i) + ",\n";
+        }
+        out += "};\n";
+
+        if (n > 0) {
+            size_t ref = rnd.below(n);
+            out += name_of("Enum", ref) + " " + name_of("pick", n) + "(" + type
+                + " e) { return " + name_of("Enum", ref) + "(" + name_of("k", ref) + "_0); }\n";
+        }
+    }
+}
+
+/// Summary
+///  Ordinary code, classes, methods, macros, strings and characters
+///
+void gen_code(std::string& out, size_t size, bench_random& rnd, bool one_line) {
+    const std::string eol = one_line ? " " : "\n";
+    for (size_t n = 0; out.size() < size; ++n) {
+        std::string type = name_of("Widget", n);
+        if (!one_line) {
+            out += "#define " + name_of("WIDGET_SIZE_", n) + " " + name_of("", rnd.below(4096)) + eol;
+            out += "// " + type + " keeps a list of children" + eol;
+        }
+
+        out += "template <typename T> class " + type + " : public std::vector<T> {" + eol;
+        out += "public:" + eol;
+        out += "    " + type + "() : _count(0), _name(\"" + type + " \\\"default\\\"\") {}" + eol;
+        for (size_t m = 0; m < 6; ++m) {
+            std::string method = name_of("method", m);
+            out += "    int " + method + "(const std::string& s, char c = '\\n') {" + eol;
+            out += "        for (int i = 0; i < (int)s.size(); ++i) {" + eol;
+            out += "            if (s[i] == c && _count < " + name_of("", rnd.below(100)) + ") { ++_count; }" + eol;
+            out += "            if (!_count) continue; else break;" + eol;
+            out += "        }" + eol;
+            out += "        return printf(\"%d\\n\", _count) + (std::string(\"<\") + \"&>\").size(); /* a */ ; /* b */" + eol;
+            out += "    }" + eol;
+        }
+        out += "private:" + eol;
+        out += "    int _count;" + eol;
+        out += "    std::string _name;" + eol;
+        out += "};" + eol;
+
+        if (n > 0) {
+            out += name_of("Widget", rnd.below(n)) + "<int> " + name_of("instance", n) + ";" + eol;
+        }
+    }
+    out += '\n';
+}
+
+void gen_mixed(std::string& out, size_t size, bench_random& rnd) {
+    out += "#include <string>\n#include <vector>\n#include <stdio.h>\n";
+    gen_code(out, size, rnd, false);
+}
+
+/// Summary
+///  All code on a single line, without comments and preprocessors that would
+/// end at the line break
+///
+void gen_long_lines(std::string& out, size_t size, bench_random& rnd) {
+    gen_code(out, size, rnd, true);
+}
+
+struct bench_case {
+    const char* name;
+    void (*generate)(std::string& out, size_t size, bench_random& rnd);
+};
+
+static const bench_case bench_cases[] = {
+    { "comment_blocks", gen_comment_blocks },
+    { "namespace_nesting", gen_namespace_nesting },
+    { "enums", gen_enums },
+    { "long_lines", gen_long_lines },
+    { "mixed", gen_mixed }
+};
+
+/// Summary
+///  Best time of a phase over the repetitions of a case
+///
+struct phase_result {
+    std::string name;
+    double      seconds;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void keep_best(std::vector<phase_result>& phases, size_t i, const char* name, double seconds) {
+    if (phases.size() <= i) {
+        phase_result r;
+        r.name = name;
+        r.seconds = seconds;
+        phases.push_back(r);
+    }
+    else if (seconds < phases[i].seconds) {
+        phases[i].seconds = seconds;
+    }
+}
+
+void print_rate(const char* key, double seconds, size_t bytes, size_t tokens) {
+    double mb_per_s = seconds > 0 ? bytes / seconds / 1e6 : 0;
+    double tokens_per_s = seconds > 0 ? tokens / seconds : 0;
+    printf("\"%s\": {\"seconds\": %.9f, \"mb_per_s\": %.2f, \"tokens_per_s\": %.0f}",
+           key, seconds, mb_per_s, tokens_per_s);
+}
+
+/// Summary
+///  Switches cc_symbol_index between the fused lexer and a pass per token
+/// type over the whole stream, which is the fused lexer with a window as
+/// large as the stream
+///
+class cc_bench_lexer {
+public:
+    static void set_multi_pass(cc_symbol_index& index, bool multi_pass) {
+        index._multi_pass = multi_pass;
+    }
+};
+
+/// Summary
+///  Class names of both renderers, the style of a byte is its index here
+///
+static const char* const style_names[][2] = {
+    { "ln", "l" }, { "id", "i" }, { "kw", "w" }, { "ut", "u" }, { "et", "e" },
+    { "es", "x" }, { "fn", "f" }, { "m", "m" }, { "k", "k" }, { "c", "c" },
+    { "s", "s" }, { "ch", "h" }, { "p", "p" }
+};
+
+/// Summary
+///  The printed bytes of a document rendered by lines_to_html(), and the
+/// style each one is drawn in, whitespace and line numbers left out
+///
+void styled_text(const std::string& doc, std::string& text, std::string& styles) {
+    const unsigned char none = 0xff;
+    std::vector<unsigned char> open;
+    size_t i = doc.find("-->\n");
+    i = i == std::string::npos ? doc.size() : i + 4;
+    while (i < doc.size()) {
+        char c = doc[i];
+        if (c == '<') {
+            size_t end = doc.find('>', i);
+            std::string tag = doc.substr(i, end - i + 1);
+            i = end + 1;
+
+            size_t name = tag.find("class=");
+            if (tag[1] == '/') {
+                if (!open.empty()) {
+                    open.pop_back();
+                }
+            }
+            else if (name != std::string::npos) {
+                name += tag[name + 6] == '"' ? 7 : 6;
+                std::string cls = tag.substr(name, tag.find_first_of("\">", name) - name);
+                unsigned char style = none;
+                for (size_t s = 0; s < sizeof(style_names) / sizeof(style_names[0]); ++s) {
+                    if (cls == style_names[s][0] || cls == style_names[s][1]) {
+                        style = (unsigned char)s;
+                    }
+                }
+                open.push_back(style);
+            }
+            continue;
+        }
+
+        if (c == '&') {
+            static const char* const entities[][2] = {
+                { "&nbsp;", " " }, { "&lt;", "<" }, { "&gt;", ">" }, { "&amp;", "&" }, { "&amp", "&" }
+            };
+            for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]); ++e) {
+                if (!doc.compare(i, strlen(entities[e][0]), entities[e][0])) {
+                    i += strlen(entities[e][0]) - 1;
+                    c = entities[e][1][0];
+                    break;
+                }
+            }
+        }
+        ++i;
+
+        unsigned char style = open.empty() ? none : open.back();
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || style == style_line_number) {
+            continue;
+        }
+        text += c;
+        styles += (char)style;
+    }
+}
+
+/// Summary
+///  Time every phase of highlighting <path>, and print the results as a JSON
+/// object
+///
+bool run_case(const char* name, const std::string& path, int repeat) {
+    cc_stream input;
+    cc_symbol_index symbols;
+    style_span_table spans;
+    std::string doc;
+    cc_parse_profile profile;
+    std::vector<phase_result> phases;
+    size_t bytes = 0, lines = 0, tokens = 0;
+
+    html_ctl ctl;
+    ctl.title = name;
+    ctl.style = "style.css";
+    ctl.lno_size = 0;
+    ctl.tab_size = 4;
+    ctl.no_header = 0;
+    ctl.std_chunk = 0;
+    ctl.first_line = ctl.last_line = 0;
+
+    symbols.set_profile(&profile);
+    for (int r = 0; r < repeat; ++r) {
+        size_t i = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!input.open(path.c_str())) {
+            fprintf(stderr, "Failed to read input file: %s\n", path.c_str());
+            return false;
+        }
+        keep_best(phases, i++, "open", seconds_since(start));
+
+        profile.clear();
+        symbols.parse_stream(input);
+        for (int p = 0; p < cc_parse_profile::phase_count; ++p) {
+            cc_parse_profile::phase ph = (cc_parse_profile::phase)p;
+            keep_best(phases, i++, cc_parse_profile::name(ph), profile.seconds[p]);
+        }
+
+        start = std::chrono::steady_clock::now();
+        sort_symbols(spans, symbols);
+        keep_best(phases, i++, "sort_symbols", seconds_since(start));
+
+        doc.clear();
+        start = std::chrono::steady_clock::now();
+        {
+            html_writer html(&doc, false);
+            source_to_html(input, html, ctl, spans);
+            html.finish();
+        }
+        keep_best(phases, i++, "source_to_html", seconds_since(start));
+
+        bytes = input.length();
+        lines = input.line_count();
+        tokens = profile.tokens;
+        input.close();
+
+        start = std::chrono::steady_clock::now();
+        symbols.clear();
+        keep_best(phases, i++, "clear", seconds_since(start));
+        spans.clear();
+    }
+
+    // The fused lexer against a pass per token type over the same file, the
+    //two parse alone and take turns so that they find the caches alike
+    double lex_seconds[2] = { 0, 0 };
+    for (int r = 0; r < repeat; ++r) {
+        for (int multi_pass = 0; multi_pass < 2; ++multi_pass) {
+            if (!input.open(path.c_str())) {
+                fprintf(stderr, "Failed to read input file: %s\n", path.c_str());
+                return false;
+            }
+
+            cc_bench_lexer::set_multi_pass(symbols, multi_pass != 0);
+            profile.clear();
+            symbols.parse_stream(input);
+            double seconds = profile.seconds[cc_parse_profile::phase_fused_lex];
+            if (r == 0 || seconds < lex_seconds[multi_pass]) {
+                lex_seconds[multi_pass] = seconds;
+            }
+            input.close();
+            symbols.clear();
+        }
+    }
+    cc_bench_lexer::set_multi_pass(symbols, false);
+    double fused = lex_seconds[0];
+    double multi_pass = lex_seconds[1];
+
+    // --compact must draw every printed byte as the default renderer does
+    std::string compact;
+    {
+        html_ctl compact_ctl = ctl;
+        compact_ctl.compact = 1;
+        compact_ctl.lno_size = 4;
+        input.open(path.c_str());
+        symbols.parse_stream(input);
+        sort_symbols(spans, symbols);
+        html_writer html(&compact, false);
+        source_to_html(input, html, compact_ctl, spans);
+        html.finish();
+        input.close();
+        symbols.clear();
+        spans.clear();
+    }
+
+    std::string text[2], styles[2];
+    styled_text(doc, text[0], styles[0]);
+    styled_text(compact, text[1], styles[1]);
+    if (text[0] != text[1] || styles[0] != styles[1]) {
+        fprintf(stderr, "--compact styles differ from the default HTML: %s\n", path.c_str());
+        return false;
+    }
+
+    double total = 0;
+    for (size_t i = 0; i < phases.size(); ++i) {
+        total += phases[i].seconds;
+    }
+
+    printf("    {\n      \"name\": \"%s\", \"bytes\": %u, \"lines\": %u, \"tokens\": %u, \"html_bytes\": %u,"
+           " \"compact_bytes\": %u,\n", name, (unsigned)bytes, (unsigned)lines, (unsigned)tokens,
+           (unsigned)doc.size(), (unsigned)compact.size());
+    printf("      ");
+    print_rate("total", total, bytes, tokens);
+    printf(",\n      \"lexer\": {\n        ");
+    print_rate("multi_pass", multi_pass, bytes, tokens);
+    printf(",\n        ");
+    print_rate("fused", fused, bytes, tokens);
+    printf(",\n        \"speedup\": %.2f\n      },\n", fused > 0 ? multi_pass / fused : 0);
+    printf("      \"phases\": {\n");
+    for (size_t i = 0; i < phases.size(); ++i) {
+        printf("        ");
+        print_rate(phases[i].name.c_str(), phases[i].seconds, bytes, tokens);
+        printf(i + 1 < phases.size() ? ",\n" : "\n");
+    }
+    printf("      }\n    }");
+    return true;
+}
+
+int print_manual() {
+    printf(
+        "Usage: blingc_bench <OPTIONS>\n"
+        "Times each phase of highlighting a generated corpus, results are written\n"
+        "to stdout as JSON. The fused lexer is also compared with lexing each token\n"
+        "type in a pass of its own, under \"lexer\". The passes run the DFAs of the\n"
+        "fused lexer, not the lexer the fused one replaced.\n\n"
+        "Available options:\n"
+        "  --corpus=<DIR>\n"
+        "    Directory the corpus is generated into. Default value is 'bench-corpus'.\n\n"
+        "  --scale=<MB>\n"
+        "    Size of each corpus file in megabytes. Default value is 1.\n\n"
+        "  --repeat=<N>\n"
+        "    Number of runs of each file, the best time of each phase is reported.\n"
+        "    Default value is 5.\n\n"
+        "  --simd=<LEVEL>\n"
+        "    Vector instructions used by the lexers, scalar, sse2 or avx2. Default\n"
+        "    value is the best the CPU supports.\n\n"
+        "  --case=<NAME>\n"
+        "    Run only the named case, may be given several times. Cases are\n"
+        "    comment_blocks, namespace_nesting, enums, long_lines and mixed.\n");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string corpus = "bench-corpus";
+    int scale = 1;
+    int repeat = 5;
+    std::vector<std::string> only;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--corpus=", 9) && argv[i][9]) {
+            corpus = argv[i] + 9;
+        }
+        else if (!strncmp(argv[i], "--scale=", 8) && atoi(argv[i] + 8) > 0) {
+            scale = atoi(argv[i] + 8);
+        }
+        else if (!strncmp(argv[i], "--repeat=", 9) && atoi(argv[i] + 9) > 0) {
+            repeat = atoi(argv[i] + 9);
+        }
+        else if (!strncmp(argv[i], "--simd=", 7)) {
+            int level = cc_simd::scalar;
+            while (level <= cc_simd::avx2 && strcmp(argv[i] + 7, cc_simd::name((cc_simd::level)level))) {
+                ++level;
+            }
+            if (level > cc_simd::avx2 || cc_simd::select((cc_simd::level)level) != level) {
+                fprintf(stderr, "Unsupported option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strncmp(argv[i], "--case=", 7)) {
+            only.push_back(argv[i] + 7);
+        }
+        else if (!strcmp(argv[i], "--help")) {
+            return print_manual();
+        }
+        else {
+            fprintf(stderr, "Bad option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    _mkdir(corpus.c_str());
+#else
+    mkdir(corpus.c_str(), 0755);
+#endif
+
+    printf("{\n  \"version\": 1, \"scale_mb\": %d, \"repeat\": %d, \"simd\": \"%s\",\n  \"cases\": [\n",
+           scale, repeat, cc_simd::name(cc_simd::current()));
+    bool first = true;
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); ++c) {
+        const bench_case& bc = bench_cases[c];
+        if (!only.empty() && std::find(only.begin(), only.end(), bc.name) == only.end()) {
+            continue;
+        }
+
+        // every case starts from the same seed, so a case is reproducible alone
+        bench_random rnd;
+        std::string source;
+        bc.generate(source, (size_t)scale << 20, rnd);
+
+        std::string path = corpus + "/" + bc.name + ".cc";
+        std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(source.data(), source.size());
+        file.close();
+        if (file.fail()) {
+            fprintf(stderr, "Failed to write corpus file: %s\n", path.c_str());
+            return 1;
+        }
+
+        if (!first) {
+            printf(",\n");
+        }
+        first = false;
+        if (!run_case(bc.name, path, repeat)) {
+            return 1;
+        }
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -1,92 +1,102 @@
-#include "cclex.h"
+#include "cchtml.h"
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <string.h>
+#include <algorithm>
 #include <fstream>
 #include <string>
 #include <iostream>
-
-enum style_class {
-    style_line_number,
-
-    style_identifier,
-    style_keyword,
-    style_user_type,    // style for user classes and enum types
-    style_external_type,
-    style_external_scope,
-    style_method,
-    style_macro,
-    style_enum_constant,
-    style_comment,
-    style_string,
-    style_character,
-    style_preprocessor
-};
-
-struct style_map : public std::map < style_class, std::string >{
-    style_map(){
-        style_map& self = *this;
-        self[style_line_number] = "ln";
-        self[style_identifier] = "id";
-        self[style_keyword] = "kw";
-        self[style_user_type] = "ut";
-        self[style_method] = "fn";
-        self[style_macro] = "m";
-        self[style_string] = "s";
-        self[style_comment] = "c";
-        self[style_character] = "ch";
-        self[style_external_type] = "et";
-        self[style_external_scope] = "es";
-        self[style_preprocessor] = "p";
-        self[style_enum_constant] = "k";
-    }
-};
-
-struct style_index : public cc_reference{
-    style_index() : style(style_identifier){}
-    style_index(const cc_reference& r, style_class s) :cc_reference(r), style(s){}
-    style_index(size_t b, size_t e, style_class s) : cc_reference(b, e), style(s){}
-    style_class   style;
-};
-
-typedef std::set<style_index, cc_reference::less> style_index_set;
-
-struct html_ctl{
-    std::string title;
-    std::string style;
-    int lno_size;
-    int tab_size;
-    int no_header;
-    int std_chunk;
-};
-
-void sort_symbols(style_index_set& iset, cc_symbol_index& symbols);
-void sort_name_def_list(style_index_set& iset, const cc_name_def_list& ref_set, style_class c);
-void sort_reference_map(style_index_set& iset, const cc_reference_map& ref_map, style_class c);
-void source_to_html(cc_stream& src, std::ostream& html, html_ctl& ctl, style_index_set& iset);
-void sort_preprocessor_list(style_index_set& iset,
-                            const cc_preprocessor_def_list& proc_list, style_class style);
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 enum config_key
 {
     ck_html_style,
     ck_output_dir,
     ck_lno_size,
+    ck_lno_step,
     ck_tab_size,
     ck_no_header,
-    ck_std_chunk
+    ck_std_chunk,
+    ck_jobs,
+    ck_cache_dir,
+    ck_serve,
+    ck_stats,
+    ck_lines,
+    ck_format,
+    ck_compact
 };
 
+/// Summary
+///  Read the output format of --format, html, spans or json
+///
+bool parse_format(const char* value, int& format) {
+    static const char* const names[] = { "html", "spans", "json" };
+    for (int i = 0; i < 3; ++i) {
+        if (!strcmp(value, names[i])) {
+            format = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Summary
+///  Extension of the output files of <format>
+///
+const char* output_extension(int format) {
+    static const char* const extensions[] = { ".html", ".spans", ".json" };
+    return extensions[format];
+}
+
+/// Summary
+///  Read the line range "A-B" of --lines, 1 <= A <= B
+///
+bool parse_line_range(const char* value, size_t& first, size_t& last) {
+    char* end;
+    if (value[0] < '1' || value[0] > '9') {
+        return false;
+    }
+    first = (size_t)strtoull(value, &end, 10);
+    if (end[0] != '-' || end[1] < '1' || end[1] > '9') {
+        return false;
+    }
+    last = (size_t)strtoull(end + 1, &end, 10);
+    return end[0] == '\0' && first <= last;
+}
+
 int parse_arg(int argc, char* argv[], std::vector<std::string>& flist,
               std::map<config_key, std::string>& arglist){
     arglist[ck_html_style] = "style.css";
     arglist[ck_tab_size] = "4";
     arglist[ck_lno_size] = "0";
+    arglist[ck_lno_step] = "1";
     arglist[ck_no_header] = "0";
     arglist[ck_std_chunk] = "0";
+    arglist[ck_jobs] = "1";
 
     for (int i = 1; i < argc; ++i){
-        if (argv[i][0] != '-') {
+        if (argv[i][0] != '-' || !argv[i][1]) {
             flist.push_back(argv[i]);
             continue;
         }
@@ -103,6 +113,12 @@ int parse_arg(int argc, char* argv[], std::vector<std::string>& flist,
             }
             else return i;
         }
+        else if (!strncmp(argv[i], "--ln-step=", 10)) {
+            if (argv[i][10] >= '1' && argv[i][10] <= '9') {
+                arglist[ck_lno_step] = argv[i] + 10;
+            }
+            else return i;
+        }
         else if (!strncmp(argv[i], "--noheader", 10)) {
             arglist[ck_no_header] = "1";
         }
@@ -115,6 +131,47 @@ int parse_arg(int argc, char* argv[], std::vector<std::string>& flist,
         else if (!strncmp(argv[i], "--stdout", 8)) {
             arglist[ck_std_chunk] = "1";
         }
+        else if (!strncmp(argv[i], "--jobs=", 7)) {
+            if (argv[i][7] >= '1' && argv[i][7] <= '9') {
+                arglist[ck_jobs] = argv[i] + 7;
+            }
+            else return i;
+        }
+        else if (!strncmp(argv[i], "--cache-dir=", 12)) {
+            if (argv[i][12]) {
+                arglist[ck_cache_dir] = argv[i] + 12;
+            }
+            else return i;
+        }
+        else if (!strncmp(argv[i], "--serve=", 8)) {
+            if (argv[i][8]) {
+                arglist[ck_serve] = argv[i] + 8;
+            }
+            else return i;
+        }
+        else if (!strcmp(argv[i], "--serve")) {
+            arglist[ck_serve] = "";
+        }
+        else if (!strcmp(argv[i], "--stats")) {
+            arglist[ck_stats] = "1";
+        }
+        else if (!strncmp(argv[i], "--lines=", 8)) {
+            size_t first, last;
+            if (parse_line_range(argv[i] + 8, first, last)) {
+                arglist[ck_lines] = argv[i] + 8;
+            }
+            else return i;
+        }
+        else if (!strcmp(argv[i], "--compact")) {
+            arglist[ck_compact] = "1";
+        }
+        else if (!strncmp(argv[i], "--format=", 9)) {
+            int format;
+            if (parse_format(argv[i] + 9, format)) {
+                arglist[ck_format] = argv[i] + 9;
+            }
+            else return i;
+        }
         else{ return i; }
     }
     return 0;
@@ -143,11 +200,13 @@ int print_manual() {
         "BLING-C is a syntax highlight tool for C/C++ source code, and it prints\n"
         "highlighted code into HTML documents.\n\n"
         "Usage: blingc <OPTIONS> <FILES>\n"
+        "A FILE of - is read from stdin and highlighted into stdout while it is\n"
+        "read, with bounded memory. --lines and --cache-dir do not apply to it.\n\n"
         "Available options:\n"
         "  --stdout\n"
         "    Writing output to stdout instead of files. When --stdout is specified,\n"
-        "    output content will be encoded with \"Chunked\" encoding, exactly \n"
-        "    one chunk for each input file.\n\n"
+        "    output content will be encoded with HTTP \"Chunked\" encoding, each\n"
+        "    input file is a sequence of chunks ended by a zero-size chunk.\n\n"
         "  --css=<PATH-TO-CSS>\n"
         "    Specifies the CSS to be used. Default value is 'style.css'\n"
         "    This option is ignored when --noheader is specified.\n\n"
@@ -156,242 +215,1280 @@ int print_manual() {
         "    Output files are written to the same directory as input files by default.\n\n"
         "  --ln=<LN-SIZE>\n"
         "    Specifies the number of digits of line number. Default value is 0.\n\n"
+        "  --ln-step=<N>\n"
+        "    Numbers only the lines whose number is a multiple of N, the others\n"
+        "    get a blank number. Default value is 1.\n\n"
         "  --tab=<TAB-SIZE>\n"
         "    Specifies the tab size. Default value is 4.\n\n"
         "  --noheader\n"
         "    Output HTML document without HTML header.\n"
         "    When this option is used, --css will be ignored.\n\n"
+        "  --compact\n"
+        "    Output a smaller HTML5 document: the source is in a <pre> with its\n"
+        "    spaces, tabs and line breaks as they are, in <span> tags, and spans of\n"
+        "    the same class separated by whitespace only are merged.\n"
+        "    Classes are one letter long, tabs are laid out by the tab-size CSS\n"
+        "    property.\n\n"
+        "  --lines=<A>-<B>\n"
+        "    Renders lines A to B only, counted from 1. With --cache-dir, the outline\n"
+        "    of the input is kept in DIR and later ranges of the same input are\n"
+        "    lexed from the nearest checkpoint before line A instead of from the top.\n\n"
+        "  --format=<html|spans|json>\n"
+        "    Specifies the output format. Default value is html. spans writes the\n"
+        "    styled spans of the source, with their classes, in a compact binary\n"
+        "    form to .spans files, json writes them to .json files, for viewers\n"
+        "    that render the source themselves. See span_encoder in cchtml.h.\n\n"
+        "  --jobs=<N>\n"
+        "    Specifies the number of files highlighted in parallel. Default value\n"
+        "    is 1. With --stdout, chunks are still written in input order.\n\n"
+        "  --cache-dir=<DIR>\n"
+        "    Keeps rendered documents in DIR, keyed by the content of the input and\n"
+        "    the options above. Inputs found in the cache are not highlighted again.\n"
+        "    Output files may be hard links into DIR, replace them instead of\n"
+        "    editing them in place.\n\n"
+        "  --serve[=<SOCKET>]\n"
+        "    Keeps running and answers the requests read from stdin, or from each\n"
+        "    connection to the Unix socket SOCKET. A request is a line of options\n"
+        "    (--css, --ln, --ln-step, --tab, --noheader, --compact, --lines,\n"
+        "    --format) followed by the path of a file, or by --inline=<SIZE> <NAME>\n"
+        "    and then SIZE bytes of source. The response is the document encoded as\n"
+        "    with --stdout, a failed request is answered with the last chunk\n"
+        "    \"0;error\" alone. Options given on the command line are the defaults\n"
+        "    of every request. With --jobs=N, up to N connections are served at\n"
+        "    once.\n\n"
+        "  --stats\n"
+        "    Prints to stderr, for each file and in total, the time spent in each\n"
+        "    phase, token and reference counts and peak buffer sizes. Heap\n"
+        "    allocations are counted too by a build made with make HEAP_STATS=1.\n\n"
         "Example:\n"
         "    blingc a.cpp\n"
-        "    blingc --css=mystyle.css a.cpp b.h --ln=5\n";
+        "    blingc --css=mystyle.css a.cpp b.h --ln=5\n"
+        "    blingc --jobs=8 --outdir=html/ src/*.cc\n"
+        "    blingc --cache-dir=.blingc-cache --outdir=html/ include/*.h\n"
+        "    git show HEAD:src/a.cpp | blingc - > a.cpp.html\n";
     return 0;
 }
 
-int main(int argc, char* argv[]) {
-    std::vector<std::string> flist;
-    std::map<config_key, std::string> arglist;
+/// Summary
+///  Heap allocations made by a thread
+///
+struct heap_counter {
+    size_t allocations;
+    size_t bytes;
+};
 
-    if (argc <= 1) {
-        return print_manual();
-    }
+// Heap allocations of the thread, counted only in builds with
+//BLINGC_HEAP_STATS (make HEAP_STATS=1) so that other builds keep the
+//allocator of the runtime untouched. The library does not count them,
+//replacing the global operator new is left to the program.
+static thread_local heap_counter thread_heap = { 0, 0 };
 
-    if (int rtn = parse_arg(argc, argv, flist, arglist)) {
-        std::cerr << "Bad option: " << argv[rtn] << '\n';
-        return 0;
+#ifdef BLINGC_HEAP_STATS
+// Deletes stay out of line, GCC takes the free() of an inlined delete for a
+//mismatch with the operator new it was allocated by
+#ifdef __GNUC__
+#define HEAP_STATS_NOINLINE __attribute__((noinline))
+#else
+#define HEAP_STATS_NOINLINE
+#endif
+
+void* operator new(size_t size) {
+    ++thread_heap.allocations;
+    thread_heap.bytes += size;
+
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
     }
+    return p;
+}
 
-    if (flist.size() == 0) {
-        std::cout << "No file to process.\n";
-        return 0;
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    ++thread_heap.allocations;
+    thread_heap.bytes += size;
+    return malloc(size ? size : 1);
+}
+
+HEAP_STATS_NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+HEAP_STATS_NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+HEAP_STATS_NOINLINE void operator delete(void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+#endif
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Summary
+///  Counters of --stats for one file, or added up over many
+///
+///  Times and counts are summed by add(), peaks are the largest of one file.
+///
+struct render_stats {
+    render_stats()
+        : files(0), bytes(0), lines(0), total_seconds(0), open_seconds(0),
+          sort_seconds(0), render_seconds(0), main_seconds(0), allocations(0),
+          allocated_bytes(0), peak_spans(0), peak_output(0) {}
+
+    void add(const render_stats& r) {
+        parse.add(r.parse);
+        files += r.files;
+        bytes += r.bytes;
+        lines += r.lines;
+        total_seconds += r.total_seconds;
+        open_seconds += r.open_seconds;
+        sort_seconds += r.sort_seconds;
+        render_seconds += r.render_seconds;
+        allocations += r.allocations;
+        allocated_bytes += r.allocated_bytes;
+        peak_spans = std::max(peak_spans, r.peak_spans);
+        peak_output = std::max(peak_output, r.peak_output);
     }
 
-    cc_stream input;
+    cc_parse_profile parse;
+    size_t  files;
+    size_t  bytes;
+    size_t  lines;
+    double  total_seconds;
+    double  open_seconds;
+    double  sort_seconds;       // sort_symbols
+    double  render_seconds;     // source_to_html, writing included
+    double  main_seconds;       // wall time of the whole run, totals only
+    size_t  allocations;
+    size_t  allocated_bytes;
+    size_t  peak_spans;         // styled spans of a file
+    size_t  peak_output;        // HTML bytes of a file
+};
+
+/// Summary
+///  Rendering state of a worker, reused for every file the worker handles
+///
+struct render_context {
+    render_context() : stats(0) {}
+
+    cc_stream       input;
     cc_symbol_index symbols;
-    style_index_set iset;
+    cc_symbol_index outline;    // of the input, while --lines are parsed
+    style_span_table spans;
 
-    html_ctl ctl;
-    ctl.style = arglist[ck_html_style];
-    ctl.lno_size = atoi(arglist[ck_lno_size].c_str());
-    ctl.tab_size = atoi(arglist[ck_tab_size].c_str());
-    ctl.no_header = atoi(arglist[ck_no_header].c_str());
-    ctl.std_chunk = atoi(arglist[ck_std_chunk].c_str());
+    // --stats counters of the file being rendered, added to <stats> when it
+    //is done. <stats> is 0 while --stats is off.
+    render_stats*   stats;
+    render_stats    file_stats;
+    heap_counter    file_heap;
+    std::chrono::steady_clock::time_point file_start;
+};
 
-    for (std::vector<std::string>::iterator fpath = flist.begin();
-         fpath != flist.end(); ++fpath){
-        if (!input.open(fpath->data())) {
-            std::cerr << "Failed to read input file: " << *fpath << '\n';
-            continue;
+int open_output(const std::string& fname) {
+#ifdef _WIN32
+    return _open(fname.data(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+    return ::open(fname.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+void close_output(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+static std::mutex report_lock;
+
+void report_error(const char* what, const std::string& path) {
+    std::lock_guard<std::mutex> guard(report_lock);
+    std::cerr << what << path << '\n';
+}
+
+void append_stat(std::string& text, const char* key, size_t value, const char* unit = "") {
+    char line[96];
+    sprintf(line, "  %-34s %llu%s\n", key, (unsigned long long)value, unit);
+    text += line;
+}
+
+void append_time(std::string& text, const char* key, double seconds) {
+    char line[96];
+    sprintf(line, "  time.%-29s %.3f ms\n", key, seconds * 1000);
+    text += line;
+}
+
+/// Summary
+///  Print the --stats counters of <title> to stderr
+///
+void print_stats(const std::string& title, const render_stats& s) {
+    std::string text = "stats: " + title + "\n";
+    append_stat(text, "files", s.files);
+    append_stat(text, "bytes", s.bytes);
+    append_stat(text, "lines", s.lines);
+    append_stat(text, "tokens", s.parse.tokens);
+    if (s.main_seconds > 0) {
+        append_time(text, "main", s.main_seconds);
+    }
+    append_time(text, "total", s.total_seconds);
+    append_time(text, "open", s.open_seconds);
+    for (int p = 0; p < cc_parse_profile::phase_count; ++p) {
+        append_time(text, cc_parse_profile::name((cc_parse_profile::phase)p), s.parse.seconds[p]);
+    }
+    append_time(text, "sort_symbols", s.sort_seconds);
+    append_time(text, "source_to_html", s.render_seconds);
+    for (int m = 0; m < cc_parse_profile::reference_map_count; ++m) {
+        std::string key = "refs.";
+        key += cc_parse_profile::name((cc_parse_profile::reference_map)m);
+        append_stat(text, key.c_str(), s.parse.references[m]);
+    }
+#ifdef BLINGC_HEAP_STATS
+    append_stat(text, "heap.allocations", s.allocations);
+    append_stat(text, "heap.bytes", s.allocated_bytes);
+#endif
+    append_stat(text, "peak.tokens", s.parse.peak_token_bytes, " bytes");
+    append_stat(text, "peak.names", s.parse.peak_name_bytes, " bytes");
+    append_stat(text, "peak.definitions", s.parse.peak_arena_bytes, " bytes");
+    append_stat(text, "peak.spans", s.peak_spans);
+    append_stat(text, "peak.output", s.peak_output, " bytes");
+
+    std::lock_guard<std::mutex> guard(report_lock);
+    std::cerr << text;
+}
+
+void enable_stats(render_context& rc, render_stats* total) {
+    rc.stats = total;
+    rc.symbols.set_profile(&rc.file_stats.parse);
+}
+
+/// Start the --stats counters of the file about to be opened in rc.input
+void begin_file_stats(render_context& rc) {
+    rc.file_stats = render_stats();
+    rc.file_heap = thread_heap;
+    rc.file_start = std::chrono::steady_clock::now();
+}
+
+/// Print the --stats counters of <fpath> and add them to the totals
+void end_file_stats(render_context& rc, const std::string& fpath) {
+    render_stats& s = rc.file_stats;
+    s.files = 1;
+    s.total_seconds = seconds_since(rc.file_start);
+    s.allocations = thread_heap.allocations - rc.file_heap.allocations;
+    s.allocated_bytes = thread_heap.bytes - rc.file_heap.bytes;
+    print_stats(fpath, s);
+    rc.stats->add(s);
+}
+
+std::string output_name(const std::string& fpath, const html_ctl& ctl,
+                        std::map<config_key, std::string>& arglist) {
+    std::string fname;
+    if (arglist.count(ck_output_dir)) {
+        fname = arglist[ck_output_dir];
+        fname += source_name(fpath);
+    }
+    else {
+        fname = fpath;
+    }
+    fname += output_extension(ctl.format);
+    return fname;
+}
+
+bool read_file(const std::string& path, std::string& data) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    if (size < 0) {
+        return false;
+    }
+    file.seekg(0, std::ios::beg);
+    data.resize((size_t)size);
+    return size == 0 || file.read(&data[0], size).gcount() == size;
+}
+
+/// Summary
+///  Make <dst> a hard link to <src>, returns false where that is not possible
+///
+bool link_file(const std::string& src, const std::string& dst) {
+#ifdef _WIN32
+    return false;
+#else
+    return ::link(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+void make_directory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    ::mkdir(path.c_str(), 0755);
+#endif
+}
+
+/// Summary
+///  Cache file in ctl.cache_dir named by a 128-bit hash of <settings> and of
+/// the content of <input>
+///
+std::string cache_name(const cc_stream& input, const std::string& settings,
+                       const char* extension, const html_ctl& ctl) {
+    uint64_t hash[2];
+    for (int i = 0; i < 2; ++i) {
+        uint64_t seed = cc_file_stamp::content_hash(settings.data(), settings.size(), i);
+        hash[i] = cc_file_stamp::content_hash(input.content(), input.length(), seed);
+    }
+
+    char text[64];
+    sprintf(text, "%016llx%016llx%s",
+            (unsigned long long)hash[0], (unsigned long long)hash[1], extension);
+    return ctl.cache_dir + text;
+}
+
+/// Summary
+///  Cache file of the document rendered from <input> with <ctl>
+///
+///  The name is a 128-bit hash of the content and of every setting that shows
+/// in the document. Bump the tag whenever the rendered HTML or spans change.
+///
+std::string cache_entry(const cc_stream& input, const html_ctl& ctl) {
+    char text[64];
+    std::string settings = "blingc-html-1\n";
+    sprintf(text, "%d %d %d\n", ctl.lno_size, ctl.tab_size, ctl.no_header);
+    settings += text;
+    if (ctl.first_line || ctl.last_line) {
+        sprintf(text, "lines %llu %llu\n",
+                (unsigned long long)ctl.first_line, (unsigned long long)ctl.last_line);
+        settings += text;
+    }
+    if (ctl.format != format_html) {
+        sprintf(text, "format %d\n", ctl.format);
+        settings += text;
+    }
+    if (ctl.compact) {
+        settings += "compact\n";
+    }
+    if (ctl.lno_step != 1) {
+        sprintf(text, "step %d\n", ctl.lno_step);
+        settings += text;
+    }
+    // The title and style may hold any byte, each is written after its length
+    if (ctl.format == format_json || (ctl.format == format_html && !ctl.no_header)) {
+        sprintf(text, "title %llu\n", (unsigned long long)ctl.title.size());
+        settings += text;
+        settings += ctl.title;
+    }
+    if (ctl.format == format_html && !ctl.no_header) {
+        sprintf(text, "\nstyle %llu\n", (unsigned long long)ctl.style.size());
+        settings += text;
+        settings += ctl.style;
+    }
+    return cache_name(input, settings, output_extension(ctl.format), ctl);
+}
+
+/// Summary
+///  Cache file of the outline of <input>, see cc_symbol_index::save_outline
+///
+///  Bump the tag whenever the outline or the checkpoints change.
+///
+std::string outline_entry(const cc_stream& input, const html_ctl& ctl) {
+    return cache_name(input, "blingc-outline-1\n", ".outline", ctl);
+}
+
+/// Summary
+///  Publish <doc> as the cache file <entry>
+///
+///  The document is written to a temporary file first and renamed, so other
+/// jobs and processes sharing the cache never read a partial entry.
+///
+void store_cache(const std::string& entry, const std::string& doc) {
+    static std::atomic<unsigned> serial(0);
+    char suffix[48];
+#ifdef _WIN32
+    sprintf(suffix, ".%d.%u.tmp", _getpid(), serial++);
+#else
+    sprintf(suffix, ".%d.%u.tmp", (int)getpid(), serial++);
+#endif
+
+    std::string temp = entry + suffix;
+    int fd = open_output(temp);
+    if (fd < 0) {
+        return;
+    }
+
+    bool result = write_fd(fd, doc.data(), doc.size());
+    close_output(fd);
+    if (!result || rename(temp.c_str(), entry.c_str()) != 0) {
+        remove(temp.c_str());
+    }
+}
+
+/// Summary
+///  Parse the --lines of rc.input
+///
+///  With an outline of the input in ctl.cache_dir, only the lines are lexed,
+/// from the checkpoint before them. Otherwise the whole input is parsed and
+/// its outline stored for the next range.
+///
+bool parse_range(render_context& rc, const html_ctl& ctl) {
+    size_t first = ctl.first_line ? ctl.first_line - 1 : 0;
+    size_t last = ctl.last_line ? ctl.last_line : rc.input.line_count();
+
+    std::string entry, outline;
+    if (!ctl.cache_dir.empty()) {
+        entry = outline_entry(rc.input, ctl);
+        bool parsed = read_file(entry, outline)
+            && rc.outline.load_outline(outline.data(), outline.size())
+            && rc.symbols.parse_lines(rc.input, rc.outline, first, last);
+        rc.outline.clear();
+        if (parsed) {
+            return true;
+        }
+    }
+
+    if (!rc.symbols.parse_stream(rc.input)) {
+        return false;
+    }
+    if (!entry.empty()) {
+        outline.clear();
+        rc.symbols.save_outline(outline);
+        store_cache(entry, outline);
+    }
+    return true;
+}
+
+/// Summary
+///  Parse rc.input and render it into <html>
+///
+bool highlight(render_context& rc, html_writer& html, html_ctl& ctl) {
+    bool parsed = ctl.first_line || ctl.last_line ?
+        parse_range(rc, ctl) : rc.symbols.parse_stream(rc.input);
+    if (!parsed) {
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point start;
+    if (rc.stats) {
+        start = std::chrono::steady_clock::now();
+    }
+    sort_symbols(rc.spans, rc.symbols);
+    if (rc.stats) {
+        rc.file_stats.sort_seconds += seconds_since(start);
+        start = std::chrono::steady_clock::now();
+    }
+
+    if (ctl.format == format_html) {
+        source_to_html(rc.input, html, ctl, rc.spans);
+    }
+    else {
+        source_to_spans(rc.input, html, ctl, rc.spans);
+    }
+    if (rc.stats) {
+        rc.file_stats.render_seconds += seconds_since(start);
+        rc.file_stats.peak_spans = std::max(rc.file_stats.peak_spans, rc.spans.size());
+        rc.file_stats.peak_output = std::max(rc.file_stats.peak_output, html.written());
+    }
+    return true;
+}
+
+/// Summary
+///  Write the whole document <doc> as render_file() does
+///
+bool write_document(const std::string& doc, const std::string& fname,
+                    const html_ctl& ctl, std::string* chunk_buffer) {
+    bool result;
+    if (chunk_buffer && ctl.std_chunk) {
+        html_writer html(chunk_buffer, true);
+        html.write(doc.data(), doc.size());
+        result = html.finish();
+    }
+    else if (ctl.std_chunk) {
+        html_writer html(1, true);
+        html.write(doc.data(), doc.size());
+        result = html.finish();
+    }
+    else {
+        int fd = open_output(fname);
+        result = fd >= 0 && write_fd(fd, doc.data(), doc.size());
+        if (fd >= 0) {
+            close_output(fd);
         }
+    }
+
+    if (!result) {
+        report_error("Failed to write output file: ", ctl.std_chunk ? "<stdout>" : fname);
+    }
+    return result;
+}
 
-        std::string fname;
-        if (arglist.count(ck_output_dir)) {
-            fname = arglist[ck_output_dir];
-            fname += source_name(*fpath);
-            fname += ".html";
+/// Summary
+///  render_file() through the cache in ctl.cache_dir
+///
+///  A document found in the cache is linked or copied to the output, <input>
+/// is not parsed then. Otherwise the document is rendered in memory and stored
+/// in the cache before it is written out.
+///
+bool render_cached(render_context& rc, const std::string& fpath,
+                   const std::string& fname, html_ctl& ctl, std::string* chunk_buffer) {
+    std::string entry = cache_entry(rc.input, ctl);
+    if (!ctl.std_chunk) {
+        // the output may be a link to an entry, replace it instead of writing through
+        remove(fname.c_str());
+        if (link_file(entry, fname)) {
+            rc.input.close();
+            return true;
+        }
+    }
+
+    std::string doc;
+    bool result = read_file(entry, doc);
+    if (!result) {
+        html_writer html(&doc, false);
+        result = highlight(rc, html, ctl);
+        if (result) {
+            html.finish();
+            store_cache(entry, doc);
         }
         else {
-            fname = *fpath;
-            fname += ".html";
+            report_error("Failed to parse file: ", fpath);
+        }
+        rc.symbols.clear();
+        rc.spans.clear();
+    }
+
+    rc.input.close();
+    return result && write_document(doc, fname, ctl, chunk_buffer);
+}
+
+/// Summary
+///  Highlight the open rc.input into <fname>, or into stdout when ctl.std_chunk
+/// is set, rc.input is closed afterwards
+///
+///  When <chunk_buffer> is given, stdout chunks are appended to it instead of
+/// being written out. <fpath> names the input in error messages.
+///
+bool render_input(render_context& rc, const std::string& fpath,
+                  const std::string& fname, html_ctl& ctl, std::string* chunk_buffer) {
+    if (rc.stats) {
+        rc.file_stats.open_seconds = seconds_since(rc.file_start);
+        rc.file_stats.bytes = rc.input.length();
+        rc.file_stats.lines = rc.input.line_count();
+    }
+
+    if (!ctl.cache_dir.empty()) {
+        return render_cached(rc, fpath, fname, ctl, chunk_buffer);
+    }
+
+    int fd = 1;
+    if (!ctl.std_chunk){
+        fd = open_output(fname);
+        if (fd < 0) {
+            report_error("Failed to write output file: ", fname);
+            rc.input.close();
+            return false;
         }
+    }
+
+    // parse, sort symbols and construct html document based on the index
+    bool parsed, result;
+    if (chunk_buffer && ctl.std_chunk) {
+        html_writer html(chunk_buffer, true);
+        parsed = highlight(rc, html, ctl);
+        result = parsed && html.finish();
+    }
+    else {
+        html_writer html(fd, ctl.std_chunk != 0);
+        parsed = highlight(rc, html, ctl);
+        result = parsed && html.finish();
+    }
+
+    if (!parsed) {
+        report_error("Failed to parse file: ", fpath);
+    }
+    else if (!result) {
+        report_error("Failed to write output file: ", ctl.std_chunk ? "<stdout>" : fname);
+    }
+
+    if (!ctl.std_chunk) {
+        close_output(fd);
+    }
+    rc.input.close();
+    rc.symbols.clear();
+    rc.spans.clear();
+    return result;
+}
 
-        std::ofstream outf;
-        std::ostream* output = &std::cout;
-        if (!ctl.std_chunk){
-            outf.open(fname.data(), std::ios::out | std::ios::trunc);
-            if (!outf) {
-                std::cerr << "Failed to write output file: " << fname << '\n';
-                input.close();
+/// Summary
+///  Highlight <fpath> into <fname>, or into stdout when ctl.std_chunk is set
+///
+bool render_file(render_context& rc, const std::string& fpath,
+                 const std::string& fname, html_ctl ctl, std::string* chunk_buffer) {
+    if (rc.stats) {
+        begin_file_stats(rc);
+    }
+
+    if (!rc.input.open(fpath.data())) {
+        report_error("Failed to read input file: ", fpath);
+        return false;
+    }
+
+    ctl.title = source_name(fpath);
+    bool result = render_input(rc, fpath, fname, ctl, chunk_buffer);
+    if (rc.stats) {
+        end_file_stats(rc, fpath);
+    }
+    return result;
+}
+
+/// Summary
+///  Queue of files shared by the --jobs workers
+///
+///  Files are handed out in input order. Chunks rendered for stdout are kept
+/// until every file before them has been written, and workers never run more
+/// than <window> files ahead of the writer.
+///
+class render_queue {
+public:
+    render_queue(size_t count, size_t window)
+        : _next(0), _written(0), _window(window), _chunks(count), _done(count, false) {}
+
+    /// Take the next file to render, returns false when there is none
+    bool take(size_t& idx) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_next < _done.size() && _next >= _written + _window) {
+            _cond.wait(lock);
+        }
+
+        if (_next >= _done.size()) {
+            return false;
+        }
+        idx = _next++;
+        return true;
+    }
+
+    void finish(size_t idx, std::string& chunk) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _chunks[idx].swap(chunk);
+        _done[idx] = true;
+        _cond.notify_all();
+    }
+
+    /// Write chunks to <fd> in input order until all files are done
+    void write_all(int fd) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_written < _done.size()) {
+            if (!_done[_written]) {
+                _cond.wait(lock);
                 continue;
             }
-            output = &outf;
-        }
 
-        // do parsing
-        if (!symbols.parse_stream(input)) {
-            std::cerr << "Failed to parse file: " << *fpath << '\n';
-            continue;
+            std::string chunk;
+            chunk.swap(_chunks[_written]);
+            lock.unlock();
+            write_fd(fd, chunk.data(), chunk.size());
+            lock.lock();
+
+            ++_written;
+            _cond.notify_all();
         }
+    }
 
-        // sort symbols
-        sort_symbols(iset, symbols);
+private:
+    std::mutex                  _mutex;
+    std::condition_variable     _cond;
+    size_t                      _next;
+    size_t                      _written;
+    size_t                      _window;
+    std::vector<std::string>    _chunks;
+    std::vector<bool>           _done;
+};
 
-        // construct html document based on the index
-        ctl.title = source_name(*fpath);
-        source_to_html(input, *output, ctl, iset);
+void render_worker(render_queue* queue, const std::vector<std::string>* flist,
+                   const std::vector<std::string>* fnames, html_ctl ctl, render_stats* stats) {
+    render_context rc;
+    if (stats) {
+        enable_stats(rc, stats);
+    }
 
-        input.close();
-        outf.close();
-        symbols.clear();
-        iset.clear();
+    size_t idx;
+    while (queue->take(idx)) {
+        std::string chunk;
+        render_file(rc, (*flist)[idx], (*fnames)[idx], ctl, &chunk);
+        queue->finish(idx, chunk);
     }
-    return 0;
 }
 
-void sort_symbols(style_index_set& iset, cc_symbol_index& symbols){
-    sort_preprocessor_list(iset, symbols.preprocessor_def_list(), style_preprocessor);
-    sort_name_def_list(iset, symbols.comment_def_list(), style_comment);
-    sort_name_def_list(iset, symbols.string_def_list(), style_string);
-    sort_name_def_list(iset, symbols.character_def_list(), style_character);
-    sort_name_def_list(iset, symbols.include_def_list(), style_string);
-    sort_reference_map(iset, symbols.external_type_ref_map(), style_external_type);
-    sort_reference_map(iset, symbols.external_scope_ref_map(), style_external_scope);
-    sort_reference_map(iset, symbols.keyword_ref_map(), style_keyword);
-    sort_reference_map(iset, symbols.class_ref_map(), style_user_type);
-    sort_reference_map(iset, symbols.enum_ref_map(), style_user_type);
-    sort_reference_map(iset, symbols.macro_ref_map(), style_macro);
-    sort_reference_map(iset, symbols.constant_ref_map(), style_enum_constant);
-    sort_reference_map(iset, symbols.method_ref_map(), style_method);
+int read_fd(int fd, char* data, size_t size) {
+    for (;;) {
+#ifdef _WIN32
+        int n = _read(fd, data, (unsigned int)size);
+#else
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        return (int)n;
+    }
 }
 
-void sort_name_def_list(style_index_set& iset,
-                        const cc_name_def_list& def_list, style_class style){
-    cc_name_def_list::const_iterator it;
-    for (it = def_list.begin(); it != def_list.end(); ++it){
-        iset.insert(style_index(it->name_ref, style));
+/// Summary
+///  Buffered reader of the requests of a --serve session
+///
+class request_reader {
+public:
+    explicit request_reader(int fd) : _fd(fd), _begin(0), _end(0) {}
+
+    /// Read a line without its line break, returns false at the end of input
+    bool read_line(std::string& line) {
+        line.clear();
+        for (;;) {
+            char* lf = (char*)memchr(_data + _begin, '\n', _end - _begin);
+            if (lf) {
+                line.append(_data + _begin, lf);
+                _begin = lf - _data + 1;
+                break;
+            }
+
+            line.append(_data + _begin, _data + _end);
+            _begin = _end;
+            if (!_fill()) {
+                if (line.empty()) {
+                    return false;
+                }
+                break;
+            }
+        }
+
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        return true;
+    }
+
+    /// Read exactly <n> bytes, returns false if the input ends before
+    bool read(std::string& data, size_t n) {
+        data.clear();
+        while (data.size() < n) {
+            if (_begin == _end && !_fill()) {
+                return false;
+            }
+
+            size_t size = std::min(n - data.size(), _end - _begin);
+            data.append(_data + _begin, size);
+            _begin += size;
+        }
+        return true;
+    }
+
+    /// Skip exactly <n> bytes, returns false if the input ends before
+    bool skip(size_t n) {
+        while (n) {
+            if (_begin == _end && !_fill()) {
+                return false;
+            }
+
+            size_t size = std::min(n, _end - _begin);
+            _begin += size;
+            n -= size;
+        }
+        return true;
+    }
+
+private:
+    enum { buffer_size = 64 * 1024 };
+
+    bool _fill() {
+        int n = read_fd(_fd, _data, buffer_size);
+        _begin = 0;
+        _end = n > 0 ? n : 0;
+        return n > 0;
+    }
+
+    int     _fd;
+    size_t  _begin;
+    size_t  _end;
+    char    _data[buffer_size];
+};
+
+/// Summary
+///  Parse the options and the source of a --serve request line
+///
+///  Options override the defaults in <ctl>. <inline_size> is set to the size
+/// of the source following the line, or to npos when <path> is a file. It is
+/// set as soon as --inline is read, even if the request turns out bad, so
+/// that the source can be skipped.
+///
+bool parse_request(const std::string& line, html_ctl& ctl,
+                   std::string& path, size_t& inline_size) {
+    inline_size = std::string::npos;
+    size_t pos = 0;
+    while (!line.compare(pos, 2, "--")) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+
+        std::string opt = line.substr(pos, end - pos);
+        const char* value = strchr(opt.c_str(), '=');
+        value = value ? value + 1 : "";
+        if (!opt.compare(0, 6, "--css=")) {
+            ctl.style = value;
+        }
+        else if (!opt.compare(0, 5, "--ln=") && value[0] >= '1' && value[0] <= '9') {
+            ctl.lno_size = atoi(value);
+        }
+        else if (!opt.compare(0, 10, "--ln-step=") && value[0] >= '1' && value[0] <= '9') {
+            ctl.lno_step = atoi(value);
+        }
+        else if (!opt.compare(0, 6, "--tab=") && value[0] >= '1' && value[0] <= '9') {
+            ctl.tab_size = atoi(value);
+        }
+        else if (opt == "--noheader") {
+            ctl.no_header = 1;
+        }
+        else if (opt == "--compact") {
+            ctl.compact = 1;
+        }
+        else if (!opt.compare(0, 9, "--format=")) {
+            if (!parse_format(value, ctl.format)) {
+                return false;
+            }
+        }
+        else if (!opt.compare(0, 8, "--lines=")) {
+            if (!parse_line_range(value, ctl.first_line, ctl.last_line)) {
+                return false;
+            }
+        }
+        else if (!opt.compare(0, 9, "--inline=") && value[0] >= '0' && value[0] <= '9') {
+            char* end;
+            unsigned long long size = strtoull(value, &end, 10);
+            if (*end || size == ULLONG_MAX) {
+                return false;
+            }
+            inline_size = (size_t)size;
+        }
+        else {
+            return false;
+        }
+
+        pos = line.find_first_not_of(' ', end);
+        if (pos == std::string::npos) {
+            return false;
+        }
     }
+
+    path = line.substr(pos);
+    return !path.empty();
 }
 
-void sort_reference_map(style_index_set& iset,
-                        const cc_reference_map& ref_map, style_class style){
-    cc_reference_map::const_iterator it_map;
-    for (it_map = ref_map.begin(); it_map != ref_map.end(); ++it_map){
-        cc_reference_set::const_iterator it_set;
-        for (it_set = it_map->second.begin(); it_set != it_map->second.end(); ++it_set){
-            iset.insert(style_index(*it_set, style));
+/// Summary
+///  Answer the requests read from <in> on <out> until the end of input
+///
+///  Each response is the chunked document --stdout writes, a failed request
+/// is answered with the last chunk "0;error" alone.
+///
+void serve_session(render_context& rc, int in, int out, const html_ctl& defaults) {
+    static const char error_chunk[] = "0;error\r\n\r\n";
+    request_reader reader(in);
+    std::string line, path, source, chunk;
+    while (reader.read_line(line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        html_ctl ctl = defaults;
+        ctl.std_chunk = 1;
+        size_t inline_size;
+        bool result = parse_request(line, ctl, path, inline_size);
+        chunk.clear();
+        if (!result) {
+            report_error("Bad request: ", line);
+            // the source of a bad request must not be read as requests
+            if (inline_size != std::string::npos && !reader.skip(inline_size)) {
+                break;
+            }
+        }
+        else if (inline_size == std::string::npos) {
+            result = render_file(rc, path, path, ctl, &chunk);
+        }
+        else {
+            if (!reader.read(source, inline_size)) {
+                break;
+            }
+            if (rc.stats) {
+                begin_file_stats(rc);
+            }
+            rc.input.assign(source.data(), source.size());
+            ctl.title = source_name(path);
+            result = render_input(rc, path, path, ctl, &chunk);
+            if (rc.stats) {
+                end_file_stats(rc, path);
+            }
+        }
+
+        if (!result) {
+            chunk.assign(error_chunk, sizeof(error_chunk) - 1);
+        }
+        if (!write_fd(out, chunk.data(), chunk.size())) {
+            break;
         }
     }
 }
 
-void sort_preprocessor_list(style_index_set& iset,
-                            const cc_preprocessor_def_list& proc_list, style_class style){
-    cc_preprocessor_def_list::const_iterator it;
-    for (it = proc_list.begin(); it != proc_list.end(); ++it){
-        iset.insert(style_index(it->line_ref.begin, it->name_ref.end, style));
+#ifndef _WIN32
+/// Summary
+///  Listen on the Unix socket <path>, a stale socket file is replaced
+///
+int listen_socket(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
     }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-void begin_label(std::string& buff, style_class idx){
-    static style_map label_class;
+void serve_worker(int listener, html_ctl ctl, bool stats) {
+    render_context rc;
+    render_stats total;
+    if (stats) {
+        enable_stats(rc, &total);
+    }
 
-    buff += "<label class=\"";
-    buff += label_class[idx];
-    buff += "\">";
+    for (;;) {
+        int conn = accept(listener, 0, 0);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            report_error("Failed to accept connection: ", strerror(errno));
+            return;
+        }
+
+        serve_session(rc, conn, conn, ctl);
+        ::close(conn);
+    }
 }
+#endif
 
-void close_label(std::string& buff){
-    buff += "</label>";
+/// Summary
+///  Run --serve on stdin and stdout, or on <socket_path> with <jobs>
+/// connections served at once
+///
+///  With <stats>, the counters of every request are printed, and the totals
+/// when stdin ends.
+///
+int serve(const std::string& socket_path, const html_ctl& ctl, size_t jobs, bool stats) {
+    if (socket_path.empty()) {
+#ifdef _WIN32
+        _setmode(0, _O_BINARY);
+        _setmode(1, _O_BINARY);
+#endif
+        render_context rc;
+        render_stats total;
+        if (stats) {
+            enable_stats(rc, &total);
+        }
+
+        serve_session(rc, 0, 1, ctl);
+        if (stats) {
+            print_stats("total", total);
+        }
+        return 0;
+    }
+
+#ifdef _WIN32
+    report_error("Unix sockets are not supported: ", socket_path);
+    return 1;
+#else
+    int listener = listen_socket(socket_path);
+    if (listener < 0) {
+        report_error("Failed to listen on socket: ", socket_path);
+        return 1;
+    }
+
+    // a client hanging up must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < jobs; ++i) {
+        workers.push_back(std::thread(serve_worker, listener, ctl, stats));
+    }
+    serve_worker(listener, ctl, stats);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    ::close(listener);
+    return 1;
+#endif
 }
 
-void source_to_html(cc_stream& src, std::ostream& output,
-                    html_ctl& ctl, style_index_set& iset){
-    size_t line = 1;
-    char lno_format[16] = { 0 };
-    char lno[16];
-    bool add_line_num = (ctl.lno_size != 0);
-    if (add_line_num){
-        sprintf(lno_format, "%%0%dd", ctl.lno_size);
+/// Summary
+///  Highlight stdin into stdout while it is read, for the input "-"
+///
+///  The input is parsed in windows of whole lines. A window is rendered up to
+/// its last idle checkpoint, where no comment, string or token runs on, and
+/// the lines after it are parsed again together with the input read next.
+/// The lines before the checkpoint stay in the window as lookbehind for the
+/// resolvers, and the classes, enums and external types of the lines rendered
+/// go to rc.outline for the windows that follow. Memory is thus bounded by
+/// the window and by the names of the input rather than by its length.
+///
+bool render_stdin(render_context& rc, html_ctl ctl) {
+    enum {
+        read_size = 64 * 1024,
+        window_size = 1024 * 1024,
+        max_window = 64 * 1024 * 1024   // rendered even without a checkpoint
+    };
+
+    if (rc.stats) {
+        begin_file_stats(rc);
     }
 
-    const char* data = src.content();
-    style_index_set::iterator it_label = iset.begin();
-    style_index_set::iterator it_label_end = iset.end();
-    size_t tab_col = 0;
+    ctl.title = "stdin";
+    html_writer html(1, ctl.std_chunk != 0);
+    span_encoder encoder(html, ctl);
+    if (ctl.format == format_html) {
+        html_begin(html, ctl);
+    }
+    else {
+        encoder.begin(ctl, 1);
+    }
 
-    // output HTML contents
-    std::string html =
-        "<!--This document is generated by BLING-C https://github.com/algoriz/blingc -->\n";
-    for (size_t gp = 0; gp < src.length(); ++gp){
-        if (add_line_num) {
-            sprintf(lno, lno_format, line);
-            begin_label(html, style_line_number);
-            html += lno;
-            close_label(html);
-            add_line_num = false;
-            tab_col = 0;
+    std::string window;         // input from the lookbehind on
+    size_t render_from = 0;     // where rendering resumes in the window
+    size_t line_base = 1;       // number of the first line of the window
+    size_t wanted = window_size;
+    bool eof = false;
+    for (;;) {
+        while (!eof && window.size() - render_from < wanted) {
+            size_t size = window.size();
+            window.resize(size + read_size);
+            int n = read_fd(0, &window[size], read_size);
+            window.resize(size + (n > 0 ? n : 0));
+            eof = n <= 0;
+            if (rc.stats) {
+                rc.file_stats.bytes += n > 0 ? n : 0;
+            }
         }
 
-        if ((it_label != it_label_end) && (gp == it_label->end)) {
-            close_label(html);
-            ++it_label;
+        size_t limit = eof || window.size() >= max_window ?
+            window.size() : window.rfind('\n') + 1;
+        if (!eof && limit <= render_from) {
+            wanted += window_size;
+            continue;
         }
 
-        if ((it_label != it_label_end) && (gp == it_label->begin)) {
-            begin_label(html, it_label->style);
+        rc.input.assign(window.data(), limit);
+        if (!rc.symbols.parse_window(rc.input, rc.outline)) {
+            report_error("Failed to parse file: ", "<stdin>");
+            return false;
         }
 
-        switch (data[gp]) {
-        case '\r':
-            break;
-        case '<':
-            html += "&lt;";
-            ++tab_col;
-            break;
-        case '>':
-            html += "&gt;";
-            ++tab_col;
-            break;
-        case ' ':
-            html += "&nbsp;";
-            ++tab_col;
-            break;
-        case '&':
-            html += "&amp";
-            ++tab_col;
-            break;
-        case '\t':
-            html.append(ctl.tab_size - (tab_col % 4), ' ');
-            tab_col = 0;
-            break;
-        case '\n':
-            html += "<br/>";
-            ++line;
-            if (ctl.lno_size){
-                add_line_num = true;
+        // The last idle checkpoint past the lines rendered, and the one before
+        const cc_lex_checkpoint_list& cps = rc.symbols.checkpoints();
+        const cc_lex_checkpoint* cut = 0;
+        const cc_lex_checkpoint* lookbehind = 0;
+        const cc_lex_checkpoint* last = 0;
+        for (size_t i = 0; !eof && i < cps.size(); ++i) {
+            if (cps[i].idle()) {
+                if (cps[i].pos > render_from) {
+                    cut = &cps[i];
+                    lookbehind = last;
+                }
+                last = &cps[i];
             }
+        }
+        if (!eof && !cut && window.size() < max_window) {
+            rc.input.close();
+            wanted += window_size;
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point start;
+        if (rc.stats) {
+            start = std::chrono::steady_clock::now();
+        }
+        sort_symbols(rc.spans, rc.symbols);
+        if (rc.stats) {
+            rc.file_stats.sort_seconds += seconds_since(start);
+            start = std::chrono::steady_clock::now();
+        }
+
+        size_t end = eof ? rc.input.length() : cut ? cut->pos : limit;
+        if (ctl.format == format_html) {
+            lines_to_html(rc.input, html, ctl, rc.spans, render_from, end,
+                          line_base + rc.input.line_of(render_from));
+        }
+        else {
+            encoder.add(rc.spans, render_from, end);
+        }
+        if (rc.stats) {
+            rc.file_stats.render_seconds += seconds_since(start);
+            rc.file_stats.peak_spans = std::max(rc.file_stats.peak_spans, rc.spans.size());
+            rc.file_stats.lines = line_base - 1 + rc.input.line_of(end - 1) + 1;
+        }
+        rc.spans.clear();
+        if (eof) {
             break;
-        default:
-            html.append(1, data[gp]);
         }
+
+        rc.outline.add_outline(rc.symbols, render_from, end);
+        size_t keep = lookbehind ? lookbehind->pos : end;
+        if (lookbehind || cut) {
+            line_base += lookbehind ? lookbehind->line : cut->line;
+        }
+        else {
+            line_base += rc.input.line_of(end - 1) + 1;
+        }
+        render_from = end - keep;
+        window.erase(0, keep);
+        rc.input.close();
+        wanted = window_size;
     }
 
-    if (!ctl.no_header){
-        std::string header = "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\" "
-            "\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">\n"
-            "<html xmlns=\"http://www.w3.org/1999/xhtml\">\n<head>\n<title>";
-        header += ctl.title;
-        header += "</title>\n<link rel=\"stylesheet\" href=\"";
-        header += ctl.style;
-        header += "\" type=\"text/css\"/>\n</head>\n<body>\n";
-        header += html;
-        html.swap(header);
+    if (ctl.format == format_html) {
+        html_end(html, ctl);
+    }
+    else {
+        encoder.end();
     }
+    bool result = html.finish();
+    if (!result) {
+        report_error("Failed to write output file: ", "<stdout>");
+    }
+    if (rc.stats) {
+        rc.file_stats.peak_output = html.written();
+        end_file_stats(rc, "-");
+    }
+    rc.input.close();
+    rc.symbols.clear();
+    rc.outline.clear();
+    return result;
+}
 
-    if (!ctl.no_header){
-        html += "\n</body>\n</html>\n";
+int main(int argc, char* argv[]) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::string> flist;
+    std::map<config_key, std::string> arglist;
+
+    if (argc <= 1) {
+        return print_manual();
+    }
+
+    if (int rtn = parse_arg(argc, argv, flist, arglist)) {
+        std::cerr << "Bad option: " << argv[rtn] << '\n';
+        return 0;
+    }
+
+    html_ctl ctl;
+    ctl.style = arglist[ck_html_style];
+    ctl.lno_size = atoi(arglist[ck_lno_size].c_str());
+    ctl.lno_step = atoi(arglist[ck_lno_step].c_str());
+    ctl.tab_size = atoi(arglist[ck_tab_size].c_str());
+    ctl.no_header = atoi(arglist[ck_no_header].c_str());
+    ctl.std_chunk = atoi(arglist[ck_std_chunk].c_str());
+    ctl.first_line = ctl.last_line = 0;
+    if (arglist.count(ck_lines)) {
+        parse_line_range(arglist[ck_lines].c_str(), ctl.first_line, ctl.last_line);
+    }
+    ctl.compact = arglist.count(ck_compact) != 0;
+    if (arglist.count(ck_format)) {
+        parse_format(arglist[ck_format].c_str(), ctl.format);
+    }
+    if (arglist.count(ck_cache_dir)) {
+        ctl.cache_dir = arglist[ck_cache_dir];
+        make_directory(ctl.cache_dir);
+        char last = ctl.cache_dir[ctl.cache_dir.size() - 1];
+        if (last != '/' && last != '\\') {
+            ctl.cache_dir += '/';
+        }
+    }
+
+    bool stats = arglist.count(ck_stats) != 0;
+
+    if (arglist.count(ck_serve)) {
+        return serve(arglist[ck_serve], ctl, atoi(arglist[ck_jobs].c_str()), stats);
+    }
+
+    if (flist.size() == 0) {
+        std::cout << "No file to process.\n";
+        return 0;
+    }
+
+    std::vector<std::string> fnames;
+    for (std::vector<std::string>::iterator fpath = flist.begin();
+         fpath != flist.end(); ++fpath){
+        fnames.push_back(output_name(*fpath, ctl, arglist));
     }
 
-    if (ctl.std_chunk){
-        output << html.size() << "\r\n";
+    size_t jobs = atoi(arglist[ck_jobs].c_str());
+    if (jobs > flist.size()) {
+        jobs = flist.size();
     }
-    output << html;
+
+    // stdin is rendered as it is read, in order with the other inputs
+    if (std::find(flist.begin(), flist.end(), "-") != flist.end()) {
+        jobs = 1;
+    }
+
+    // one set of totals per worker, added up when all are done
+    std::vector<render_stats> totals(jobs > 1 ? jobs : 1);
+    if (jobs <= 1) {
+        render_context rc;
+        if (stats) {
+            enable_stats(rc, &totals[0]);
+        }
+        for (size_t i = 0; i < flist.size(); ++i) {
+            if (flist[i] == "-") {
+                render_stdin(rc, ctl);
+            }
+            else {
+                render_file(rc, flist[i], fnames[i], ctl, 0);
+            }
+        }
+    }
+    else {
+        render_queue queue(flist.size(), jobs * 4);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < jobs; ++i) {
+            workers.push_back(std::thread(render_worker, &queue, &flist, &fnames, ctl,
+                                          stats ? &totals[i] : (render_stats*)0));
+        }
+
+        queue.write_all(1);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+    }
+
+    if (stats) {
+        for (size_t i = 1; i < totals.size(); ++i) {
+            totals[0].add(totals[i]);
+        }
+        totals[0].main_seconds = seconds_since(start);
+        print_stats("total", totals[0]);
+    }
+    return 0;
 }
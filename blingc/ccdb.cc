@@ -0,0 +1,699 @@
+#include "cclex.h"
+
+#include <cstdio>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace std;
+
+///
+///  Symbol database
+///
+///  All integers of the header and the directory are 64-bit little endian.
+///
+///  header      magic "BLINGCDB", version (32-bit), reserved (32-bit),
+///              number of files, offset of the directory
+///  files       path and record of each file
+///  directory   offset and length of the path and the record of each file,
+///              and the size, modification time and content hash it was
+///              parsed from, ordered by path
+///
+///  A record holds one cc_symbol_index, it is a sequence of varints. Strings
+/// are written once to the string table at the head of the record and are
+/// referred to by their index. A reference is written as the difference of
+/// its begin to the begin of the previous reference in the same list, and its
+/// length. Records do not refer to each other, so a record can be decoded or
+/// copied to another database on its own.
+///
+///  The lexer checkpoints follow the references. The begin and end of the
+/// token each stage is in are written relative to the checkpoint, 0 for none.
+///
+///  An outline is a record of the definitions, the checkpoints and the first
+/// reference of each external type only, see cc_symbol_index::save_outline.
+///
+static const char       db_magic[8] = { 'B', 'L', 'I', 'N', 'G', 'C', 'D', 'B' };
+static const uint32_t   db_version = 3;
+static const size_t     db_header_size = 32;
+static const size_t     db_entry_size = 56;
+
+static void put_fixed(string& out, uint64_t v, size_t bytes){
+    for (size_t i = 0; i < bytes; ++i, v >>= 8){
+        out += char(v & 0xff);
+    }
+}
+
+static uint64_t get_fixed(const char* p, size_t bytes){
+    uint64_t v = 0;
+    for (size_t i = bytes; i > 0; --i){
+        v = (v << 8) | (unsigned char)p[i - 1];
+    }
+    return v;
+}
+
+static void put_varint(string& out, uint64_t v){
+    for (; v >= 0x80; v >>= 7){
+        out += char((v & 0x7f) | 0x80);
+    }
+    out += char(v);
+}
+
+/// Summary
+///  Varints of the differences, which may be negative, are zigzag encoded
+///
+static uint64_t zigzag(uint64_t v){
+    return (v << 1) ^ (0 - (v >> 63));
+}
+
+static uint64_t unzigzag(uint64_t v){
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+/// Summary
+///  Encodes a record, strings are pooled into the string table
+///
+class db_record_writer {
+public:
+    db_record_writer(): _position(0) {}
+
+    void varint(uint64_t v) {
+        put_varint(_body, v);
+    }
+
+    void string(const std::string& s) {
+        varint(_strings.intern(s.data(), s.size()));
+    }
+
+    void string(const char* s, size_t n) {
+        varint(_strings.intern(s, n));
+    }
+
+    void strings(const cc_scope_vect& sv) {
+        varint(sv.size());
+        for (size_t i = 0; i < sv.size(); ++i){
+            string(sv[i]);
+        }
+    }
+
+    /// Start a list of references, the first one is written as it is
+    void list(size_t size) {
+        varint(size);
+        _position = 0;
+    }
+
+    void reference(const cc_reference& ref) {
+        varint(zigzag(uint64_t(ref.begin) - _position));
+        varint(zigzag(uint64_t(ref.end) - ref.begin));
+        _position = ref.begin;
+    }
+
+    /// Append the string table and the body to <out>
+    void finish(std::string& out) const {
+        put_varint(out, _strings.size());
+        for (size_t id = 0; id < _strings.size(); ++id){
+            put_varint(out, _strings.length(id));
+            out.append(_strings.data(id), _strings.length(id));
+        }
+        out += _body;
+    }
+
+private:
+    cc_name_pool    _strings;
+    std::string     _body;
+    uint64_t        _position;
+};
+
+/// Summary
+///  Decodes a record, reads past the end make the reader fail and return
+/// zeros or empty strings
+///
+class db_record_reader {
+public:
+    db_record_reader(const char* data, size_t size)
+        : _p(data), _end(data + size), _position(0), _failed(false) {}
+
+    bool failed() const { return _failed; }
+
+    bool finished() const { return !_failed && _p == _end; }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64 && _p < _end; shift += 7){
+            unsigned char b = (unsigned char)*_p++;
+            v |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)){
+                return v;
+            }
+        }
+        _failed = true;
+        return 0;
+    }
+
+    /// Number of items that follow, every item takes at least a byte
+    size_t count() {
+        uint64_t n = varint();
+        if (n > uint64_t(_end - _p)){
+            _failed = true;
+            return 0;
+        }
+        return size_t(n);
+    }
+
+    bool read_strings() {
+        size_t n = count();
+        _strings.resize(n);
+        for (size_t i = 0; i < n; ++i){
+            uint64_t length = varint();
+            if (length > uint64_t(_end - _p)){
+                _failed = true;
+                return false;
+            }
+            _strings[i].text = _p;
+            _strings[i].length = size_t(length);
+            _p += length;
+        }
+        return !_failed;
+    }
+
+    const cc_word& word() {
+        static const cc_word empty = { "", 0 };
+        uint64_t id = varint();
+        if (id >= _strings.size()){
+            _failed = true;
+            return empty;
+        }
+        return _strings[size_t(id)];
+    }
+
+    void string(std::string& s) {
+        const cc_word& w = word();
+        s.assign(w.text, w.length);
+    }
+
+    void strings(cc_scope_vect& sv) {
+        sv.resize(count());
+        for (size_t i = 0; i < sv.size(); ++i){
+            string(sv[i]);
+        }
+    }
+
+    size_t list() {
+        _position = 0;
+        return count();
+    }
+
+    cc_reference reference() {
+        cc_reference ref;
+        ref.begin = size_t(_position + unzigzag(varint()));
+        ref.end = size_t(ref.begin + unzigzag(varint()));
+        _position = ref.begin;
+        return ref;
+    }
+
+private:
+    const char*             _p;
+    const char*             _end;
+    std::vector<cc_word>    _strings;
+    uint64_t                _position;
+    bool                    _failed;
+};
+
+static void save_name_defs(db_record_writer& w, const cc_name_def_list& dl){
+    w.list(dl.size());
+    for (cc_name_def_list::const_iterator it = dl.begin(); it != dl.end(); ++it){
+        w.string(it->name);
+        w.reference(it->name_ref);
+    }
+}
+
+static void load_name_defs(db_record_reader& r, cc_name_def_list& dl){
+    for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+        dl.push_back(cc_name_def());
+        r.string(dl.back().name);
+        dl.back().name_ref = r.reference();
+    }
+}
+
+static void save_enum_defs(db_record_writer& w, const cc_enum_def_list& dl){
+    w.list(dl.size());
+    cc_enum_def_list::const_iterator ed;
+    for (ed = dl.begin(); ed != dl.end(); ++ed){
+        w.string(ed->name);
+        w.reference(ed->name_ref);
+        w.reference(ed->body_ref);
+        w.strings(ed->nested_name);
+        w.varint(ed->value_def_list.size());
+        cc_name_def_list::const_iterator ev;
+        for (ev = ed->value_def_list.begin(); ev != ed->value_def_list.end(); ++ev){
+            w.string(ev->name);
+            w.reference(ev->name_ref);
+        }
+    }
+}
+
+static void load_enum_defs(db_record_reader& r, cc_enum_def_list& dl, cc_arena* arena){
+    for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+        dl.push_back(cc_enum_def(arena));
+        cc_enum_def& edef = dl.back();
+        r.string(edef.name);
+        edef.name_ref = r.reference();
+        edef.body_ref = r.reference();
+        r.strings(edef.nested_name);
+        for (size_t v = r.count(); v > 0 && !r.failed(); --v){
+            edef.value_def_list.push_back(cc_name_def());
+            r.string(edef.value_def_list.back().name);
+            edef.value_def_list.back().name_ref = r.reference();
+        }
+    }
+}
+
+static void save_class_defs(db_record_writer& w, const cc_class_def_list& dl){
+    w.list(dl.size());
+    cc_class_def_list::const_iterator cd;
+    for (cd = dl.begin(); cd != dl.end(); ++cd){
+        w.string(cd->key_name);
+        w.string(cd->name);
+        w.reference(cd->name_ref);
+        w.reference(cd->body_ref);
+        w.strings(cd->nested_name);
+    }
+}
+
+static void load_class_defs(db_record_reader& r, cc_class_def_list& dl, cc_arena* arena){
+    for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+        dl.push_back(cc_class_def(arena));
+        cc_class_def& cdef = dl.back();
+        r.string(cdef.key_name);
+        r.string(cdef.name);
+        cdef.name_ref = r.reference();
+        cdef.body_ref = r.reference();
+        r.strings(cdef.nested_name);
+    }
+}
+
+/// Summary
+///  Positions of a stage are relative to the checkpoint, zigzag encoded and
+/// offset by one so that 0 stands for none
+///
+static uint64_t checkpoint_offset(size_t pos, size_t p){
+    return p == size_t(-1) ? 0 : zigzag(uint64_t(pos) - p) + 1;
+}
+
+static size_t checkpoint_position(size_t pos, uint64_t v){
+    return v == 0 ? size_t(-1) : size_t(pos - unzigzag(v - 1));
+}
+
+static void save_checkpoints(db_record_writer& w, const cc_lex_checkpoint_list& cps){
+    w.varint(cps.size());
+    size_t line = 0, pos = 0;
+    for (size_t i = 0; i < cps.size(); ++i){
+        const cc_lex_checkpoint& cp = cps[i];
+        w.varint(cp.line - line);
+        w.varint(cp.pos - pos);
+        line = cp.line;
+        pos = cp.pos;
+        for (int s = 0; s < cc_lex_checkpoint::stage_count; ++s){
+            w.varint(cp.stages[s].state);
+            w.varint(cp.stages[s].back_state);
+            w.varint(checkpoint_offset(cp.pos, cp.stages[s].begin));
+            w.varint(checkpoint_offset(cp.pos, cp.stages[s].end));
+        }
+    }
+}
+
+static void load_checkpoints(db_record_reader& r, cc_lex_checkpoint_list& cps){
+    size_t line = 0, pos = 0;
+    for (size_t n = r.count(); n > 0 && !r.failed(); --n){
+        cc_lex_checkpoint cp;
+        cp.line = line += size_t(r.varint());
+        cp.pos = pos += size_t(r.varint());
+        for (int s = 0; s < cc_lex_checkpoint::stage_count; ++s){
+            cp.stages[s].state = (unsigned char)r.varint();
+            cp.stages[s].back_state = (unsigned char)r.varint();
+            cp.stages[s].begin = checkpoint_position(cp.pos, r.varint());
+            cp.stages[s].end = checkpoint_position(cp.pos, r.varint());
+        }
+        cps.push_back(cp);
+    }
+}
+
+void cc_symbol_index::save(std::string& buff) const{
+    db_record_writer w;
+
+    save_name_defs(w, _comment_def_list);
+    save_name_defs(w, _string_def_list);
+    save_name_defs(w, _character_def_list);
+    save_name_defs(w, _include_def_list);
+    save_name_defs(w, _macro_def_list);
+
+    w.list(_preprocessor_def_list.size());
+    cc_preprocessor_def_list::const_iterator pp;
+    for (pp = _preprocessor_def_list.begin(); pp != _preprocessor_def_list.end(); ++pp){
+        w.string(pp->name);
+        w.reference(pp->name_ref);
+        w.reference(pp->line_ref);
+    }
+
+    save_enum_defs(w, _enum_def_list);
+    save_class_defs(w, _class_def_list);
+
+    const cc_reference_table* tables[] = {
+        &_keyword_ref_map, &_method_ref_map, &_class_ref_map, &_enum_ref_map,
+        &_constant_ref_map, &_macro_ref_map,
+        &_external_type_ref_map, &_external_scope_ref_map
+    };
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); ++t){
+        w.varint(tables[t]->size());
+        for (size_t g = 0; g < tables[t]->size(); ++g){
+            size_t id = tables[t]->name_id(g);
+            w.string(_names.data(id), _names.length(id));
+            w.list(tables[t]->end(g) - tables[t]->begin(g));
+            for (const cc_reference* ref = tables[t]->begin(g); ref != tables[t]->end(g); ++ref){
+                w.reference(*ref);
+            }
+        }
+    }
+
+    save_checkpoints(w, _checkpoints);
+    w.finish(buff);
+}
+
+bool cc_symbol_index::load(const char* data, size_t size){
+    clear();
+
+    db_record_reader r(data, size);
+    if (!r.read_strings()){
+        return false;
+    }
+
+    load_name_defs(r, _comment_def_list);
+    load_name_defs(r, _string_def_list);
+    load_name_defs(r, _character_def_list);
+    load_name_defs(r, _include_def_list);
+    load_name_defs(r, _macro_def_list);
+
+    for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+        _preprocessor_def_list.push_back(cc_preprocessor_def());
+        cc_preprocessor_def& pdef = _preprocessor_def_list.back();
+        r.string(pdef.name);
+        pdef.name_ref = r.reference();
+        pdef.line_ref = r.reference();
+    }
+
+    load_enum_defs(r, _enum_def_list, &_arena);
+    load_class_defs(r, _class_def_list, &_arena);
+
+    cc_reference_table* tables[] = {
+        &_keyword_ref_map, &_method_ref_map, &_class_ref_map, &_enum_ref_map,
+        &_constant_ref_map, &_macro_ref_map,
+        &_external_type_ref_map, &_external_scope_ref_map
+    };
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); ++t){
+        for (size_t g = r.count(); g > 0 && !r.failed(); --g){
+            const cc_word& name = r.word();
+            size_t id = _names.intern(name.text, name.length);
+            for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+                tables[t]->insert(id, r.reference());
+            }
+        }
+        tables[t]->seal(_names);
+    }
+    load_checkpoints(r, _checkpoints);
+
+    if (!r.finished()){
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void cc_symbol_index::save_outline(std::string& buff) const{
+    db_record_writer w;
+
+    save_name_defs(w, _macro_def_list);
+    save_enum_defs(w, _enum_def_list);
+    save_class_defs(w, _class_def_list);
+    save_checkpoints(w, _checkpoints);
+
+    // The resolver only asks whether a name is an external type
+    w.list(_external_type_ref_map.size());
+    for (size_t g = 0; g < _external_type_ref_map.size(); ++g){
+        size_t id = _external_type_ref_map.name_id(g);
+        w.string(_names.data(id), _names.length(id));
+        w.reference(*_external_type_ref_map.begin(g));
+    }
+
+    w.finish(buff);
+}
+
+bool cc_symbol_index::load_outline(const char* data, size_t size){
+    clear();
+
+    db_record_reader r(data, size);
+    if (!r.read_strings()){
+        return false;
+    }
+
+    load_name_defs(r, _macro_def_list);
+    load_enum_defs(r, _enum_def_list, &_arena);
+    load_class_defs(r, _class_def_list, &_arena);
+    load_checkpoints(r, _checkpoints);
+
+    for (size_t n = r.list(); n > 0 && !r.failed(); --n){
+        const cc_word& name = r.word();
+        _external_type_ref_map.insert(_names.intern(name.text, name.length), r.reference());
+    }
+    _external_type_ref_map.seal(_names);
+
+    if (!r.finished()){
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool cc_symbol_base::save_data(const char* dbfile) const{
+    string temp_file = string(dbfile) + ".tmp";
+    FILE* fp = fopen(temp_file.c_str(), "wb");
+    if (!fp){
+        return false;
+    }
+
+    string buff(db_header_size, '\0');
+    string directory;
+    uint64_t offset = 0;
+    bool ok = true;
+
+    // Files of the database that are neither removed nor decoded are copied
+    //as they are, both the database and _symbol_map are ordered by path
+    //
+    cc_symbol_map::const_iterator it = _symbol_map.begin();
+    size_t s = 0;
+    while (ok && (it != _symbol_map.end() || s < _db_files)){
+        stored_file f = { 0, 0, 0, 0, cc_file_stamp() };
+        int order = 1;
+        if (s < _db_files){
+            f = _stored(s);
+            order = it == _symbol_map.end() ? -1 : -it->first.compare(0, string::npos, f.path, f.path_length);
+        }
+
+        if (order < 0){
+            string path(f.path, f.path_length);
+            if (_dropped.count(path)){
+                ++s;
+                continue;
+            }
+            f.stamp = _stored_stamp(path, f);
+        }
+        else{
+            f.path = it->first.data();
+            f.path_length = it->first.size();
+            f.stamp = it->second.stamp;
+        }
+        put_fixed(directory, offset + buff.size(), 8);
+        put_fixed(directory, f.path_length, 8);
+        buff.append(f.path, f.path_length);
+
+        put_fixed(directory, offset + buff.size(), 8);
+        size_t record_begin = buff.size();
+        if (order >= 0){
+            it->second.index.save(buff);
+            ++it;
+        }
+        else{
+            buff.append(f.record, f.record_length);
+        }
+        put_fixed(directory, buff.size() - record_begin, 8);
+        put_fixed(directory, f.stamp.size, 8);
+        put_fixed(directory, uint64_t(f.stamp.mtime), 8);
+        put_fixed(directory, f.stamp.hash, 8);
+
+        // a decoded file shadows its stored record
+        if (order <= 0){
+            ++s;
+        }
+
+        if (buff.size() >= 1 << 20){
+            ok = fwrite(buff.data(), 1, buff.size(), fp) == buff.size();
+            offset += buff.size();
+            buff.clear();
+        }
+    }
+
+    string header(db_magic, sizeof(db_magic));
+    put_fixed(header, db_version, 4);
+    put_fixed(header, 0, 4);
+    put_fixed(header, directory.size() / db_entry_size, 8);
+    put_fixed(header, offset + buff.size(), 8);
+    if (offset == 0){
+        buff.replace(0, db_header_size, header);
+    }
+
+    ok = ok && fwrite(buff.data(), 1, buff.size(), fp) == buff.size()
+        && fwrite(directory.data(), 1, directory.size(), fp) == directory.size()
+        && (offset == 0 || (fseek(fp, 0, SEEK_SET) == 0
+                            && fwrite(header.data(), 1, header.size(), fp) == header.size()));
+    ok = fclose(fp) == 0 && ok;
+
+#ifdef _WIN32
+    //  rename does not replace an existing file. _db does not hold <dbfile>
+    // open, cc_stream reads files into memory on Windows instead of mapping
+    //
+    ok = ok && MoveFileExA(temp_file.c_str(), dbfile, MOVEFILE_REPLACE_EXISTING) != 0;
+    if (!ok){
+#else
+    if (!ok || rename(temp_file.c_str(), dbfile) != 0){
+#endif
+        remove(temp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool cc_symbol_base::load_data(const char* dbfile){
+    drop();
+    if (!_db.open(dbfile)){
+        return false;
+    }
+
+    // The stream may have a LF appended, the size is taken from the directory
+    const char* data = _db.content();
+    size_t size = _db.length();
+    bool valid = size >= db_header_size
+        && memcmp(data, db_magic, sizeof(db_magic)) == 0
+        && get_fixed(data + 8, 4) == db_version;
+
+    uint64_t files = valid ? get_fixed(data + 16, 8) : 0;
+    uint64_t directory = valid ? get_fixed(data + 24, 8) : 0;
+    valid = valid && directory <= size && files <= (size - directory) / db_entry_size;
+
+    // Check every entry once, lookups trust the directory afterwards
+    _db_files = valid ? size_t(files) : 0;
+    for (size_t i = 0; valid && i < _db_files; ++i){
+        const char* entry = data + directory + i * db_entry_size;
+        for (size_t k = 0; valid && k < 2; ++k){
+            uint64_t off = get_fixed(entry + k * 16, 8);
+            uint64_t len = get_fixed(entry + k * 16 + 8, 8);
+            valid = off <= directory && len <= directory - off;
+        }
+
+        if (valid && i > 0){
+            stored_file prev = _stored(i - 1), cur = _stored(i);
+            int c = memcmp(prev.path, cur.path, min(prev.path_length, cur.path_length));
+            valid = c < 0 || (c == 0 && prev.path_length < cur.path_length);
+        }
+    }
+
+    if (!valid){
+        drop();
+        return false;
+    }
+    return true;
+}
+
+const cc_symbol_index* cc_symbol_base::find_index(const string& srcfile) const{
+    cc_symbol_map::const_iterator it = _symbol_map.find(srcfile);
+    if (it != _symbol_map.end()){
+        return &(it->second.index);
+    }
+
+    if (!_is_stored(srcfile)){
+        return 0;
+    }
+
+    stored_file f = _stored(_find_stored(srcfile));
+    cc_symbol_entry& entry = _symbol_map[srcfile];
+    if (!entry.index.load(f.record, f.record_length)){
+        _symbol_map.erase(srcfile);
+        return 0;
+    }
+    entry.stamp = _stored_stamp(srcfile, f);
+    return &entry.index;
+}
+
+/// Summary
+///  Index of <srcfile> in the directory of the database, or -1
+///
+size_t cc_symbol_base::_find_stored(const string& srcfile) const{
+    size_t lo = 0, hi = _db_files;
+    while (lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        stored_file f = _stored(mid);
+        int c = srcfile.compare(0, string::npos, f.path, f.path_length);
+        if (c == 0){
+            return mid;
+        }
+        if (c > 0){ lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return -1;
+}
+
+cc_symbol_base::stored_file cc_symbol_base::_stored(size_t i) const{
+    const char* data = _db.content();
+    const char* entry = data + get_fixed(data + 24, 8) + i * db_entry_size;
+
+    stored_file f;
+    f.path = data + get_fixed(entry, 8);
+    f.path_length = size_t(get_fixed(entry + 8, 8));
+    f.record = data + get_fixed(entry + 16, 8);
+    f.record_length = size_t(get_fixed(entry + 24, 8));
+    f.stamp.size = get_fixed(entry + 32, 8);
+    f.stamp.mtime = int64_t(get_fixed(entry + 40, 8));
+    f.stamp.hash = get_fixed(entry + 48, 8);
+    return f;
+}
+
+cc_file_stamp cc_symbol_base::_stored_stamp(const string& srcfile, const stored_file& f) const{
+    map<string, cc_file_stamp>::const_iterator it = _restamped.find(srcfile);
+    return it != _restamped.end() ? it->second : f.stamp;
+}
+
+/// Summary
+///  Whether <srcfile> is in the database and not removed
+///
+bool cc_symbol_base::_is_stored(const string& srcfile) const{
+    return _db_files && _find_stored(srcfile) != size_t(-1) && !_dropped.count(srcfile);
+}
+
+/// Summary
+///  Files of the database that are not decoded yet are added with empty
+/// indexes, and the database is closed
+///
+void cc_symbol_base::_unstore(){
+    for (size_t i = 0; i < _db_files; ++i){
+        stored_file f = _stored(i);
+        string path(f.path, f.path_length);
+        if (!_dropped.count(path)){
+            _symbol_map[path];
+        }
+    }
+
+    _db.close();
+    _db_files = 0;
+    _dropped.clear();
+    _restamped.clear();
+}
@@ -0,0 +1,46 @@
+#include "cchighlight.h"
+
+bool cc_highlighter::highlight(const char* data, size_t size,
+                               const html_ctl& ctl, std::string& out){
+    html_writer html(&out, false);
+    return _highlight(data, size, ctl, html) && html.finish();
+}
+
+bool cc_highlighter::highlight(const char* data, size_t size, const html_ctl& ctl,
+                               html_output output, void* context){
+    html_writer html(output, context, false);
+    return _highlight(data, size, ctl, html) && html.finish();
+}
+
+/// Summary
+///  Parse the source into the index and render it into <html>, the buffers
+/// are cleared afterwards but keep their capacity
+///
+bool cc_highlighter::_highlight(const char* data, size_t size,
+                                const html_ctl& ctl, html_writer& html){
+    if (ctl.lno_size < 0 || ctl.lno_step < 1 || ctl.tab_size < 1){
+        return false;
+    }
+
+    _input.close();
+    if (!_input.assign(data, size)){
+        return false;
+    }
+
+    bool result = _symbols.parse_stream(_input);
+    if (result){
+        html_ctl options = ctl;
+        sort_symbols(_spans, _symbols);
+        if (ctl.format == format_html){
+            source_to_html(_input, html, options, _spans);
+        }
+        else {
+            source_to_spans(_input, html, ctl, _spans);
+        }
+    }
+
+    _input.close();
+    _symbols.clear();
+    _spans.clear();
+    return result;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "cchtml.h"
+#include <string>
+
+/// Summary
+///  Highlights C/C++ source held in memory, for programs that embed BLING-C
+///
+///  Nothing is read from or written to files. A highlighter keeps its buffers
+/// from one document to the next, so it serves one thread at a time, while
+/// highlighters share no state and run on any number of threads at once.
+///
+///  Options are those of the command line, see html_ctl, and are checked as
+/// the command line does: a negative ctl.lno_size, or a ctl.lno_step or
+/// ctl.tab_size below 1 fails the call. ctl.std_chunk and ctl.cache_dir do
+/// not apply, ctl.first_line and ctl.last_line render a range of lines of
+/// the whole source.
+///
+class cc_highlighter {
+public:
+    cc_highlighter() {}
+
+    /// Summary
+    ///  Append the document of the <size> bytes of source at <data> to <out>
+    ///
+    /// Returns
+    ///  true for success, false for failure
+    ///
+    bool highlight(const char* data, size_t size, const html_ctl& ctl, std::string& out);
+
+    /// Summary
+    ///  Pass the document of the <size> bytes of source at <data> to <output>
+    /// with <context>, a piece at a time
+    ///
+    /// Returns
+    ///  false if <output> failed or the source could not be parsed
+    ///
+    bool highlight(const char* data, size_t size, const html_ctl& ctl,
+                   html_output output, void* context);
+
+private:
+    cc_highlighter(const cc_highlighter&);
+    cc_highlighter& operator=(const cc_highlighter&);
+
+    bool _highlight(const char* data, size_t size, const html_ctl& ctl, html_writer& html);
+
+    cc_stream           _input;
+    cc_symbol_index     _symbols;
+    style_span_table    _spans;
+};
@@ -0,0 +1,747 @@
+#include "cchtml.h"
+#include <string.h>
+#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/// Summary
+///  Opening tag of each style class, indexed by style_class
+///
+struct label_tag {
+    const char* data;
+    size_t      size;
+    const char* name;   // the class alone
+};
+
+#define LABEL_TAG(cls) { "<label class=\"" cls "\">", sizeof("<label class=\"" cls "\">") - 1, cls }
+#define SPAN_TAG(cls) { "<span class=" cls ">", sizeof("<span class=" cls ">") - 1, cls }
+static const label_tag label_tags[] = {
+    LABEL_TAG("ln"),    // style_line_number
+    LABEL_TAG("id"),    // style_identifier
+    LABEL_TAG("kw"),    // style_keyword
+    LABEL_TAG("ut"),    // style_user_type
+    LABEL_TAG("et"),    // style_external_type
+    LABEL_TAG("es"),    // style_external_scope
+    LABEL_TAG("fn"),    // style_method
+    LABEL_TAG("m"),     // style_macro
+    LABEL_TAG("k"),     // style_enum_constant
+    LABEL_TAG("c"),     // style_comment
+    LABEL_TAG("s"),     // style_string
+    LABEL_TAG("ch"),    // style_character
+    LABEL_TAG("p")      // style_preprocessor
+};
+
+/// The classes of --compact, one letter each, see style.css
+static const label_tag span_tags[] = {
+    SPAN_TAG("l"),      // style_line_number
+    SPAN_TAG("i"),      // style_identifier
+    SPAN_TAG("w"),      // style_keyword
+    SPAN_TAG("u"),      // style_user_type
+    SPAN_TAG("e"),      // style_external_type
+    SPAN_TAG("x"),      // style_external_scope
+    SPAN_TAG("f"),      // style_method
+    SPAN_TAG("m"),      // style_macro
+    SPAN_TAG("k"),      // style_enum_constant
+    SPAN_TAG("c"),      // style_comment
+    SPAN_TAG("s"),      // style_string
+    SPAN_TAG("h"),      // style_character
+    SPAN_TAG("p")       // style_preprocessor
+};
+#undef LABEL_TAG
+#undef SPAN_TAG
+
+/// Summary
+///  Output of each source byte in the HTML body
+///
+///  Every byte has its replacement text padded to 8 bytes, so the renderer
+/// copies a fixed 8 bytes and advances by the real size without branching.
+/// Only tabs and line breaks, which update the column and line state, leave
+/// the fast path. The compact table keeps spaces and tabs as they are, a <pre>
+/// lays them out.
+///
+struct html_escape_table {
+    enum { text_size = 8 };
+
+    explicit html_escape_table(bool compact){
+        memset(text, 0, sizeof(text));
+        memset(column, 0, sizeof(column));
+        memset(stop, 0, sizeof(stop));
+        memset(joint, 0, sizeof(joint));
+        for (int c = 0; c < 256; ++c){
+            text[c][0] = (char)c;
+            size[c] = 1;
+        }
+
+        size[(unsigned char)'\r'] = 0;
+        stop[(unsigned char)'\n'] = 1;
+        set_escape('<', "&lt;");
+        if (compact){
+            set_escape('&', "&amp;");
+            joint[(unsigned char)' '] = joint[(unsigned char)'\t'] = 1;
+            joint[(unsigned char)'\r'] = joint[(unsigned char)'\n'] = 1;
+            return;
+        }
+
+        stop[(unsigned char)'\t'] = 1;
+        set_escape('>', "&gt;");
+        set_escape(' ', "&nbsp;");
+        set_escape('&', "&amp");
+    }
+
+    void set_escape(char c, const char* entity){
+        memcpy(text[(unsigned char)c], entity, strlen(entity));
+        size[(unsigned char)c] = (unsigned char)strlen(entity);
+        column[(unsigned char)c] = 1;
+    }
+
+    char            text[256][text_size];
+    unsigned char   size[256];
+    unsigned char   column[256];    // escaped bytes count as one tab column
+    unsigned char   stop[256];
+    unsigned char   joint[256];     // whitespace, may join two spans
+};
+
+/// Summary
+///  Zero padded decimal line number, incremented in place
+///
+class line_number_text {
+public:
+    explicit line_number_text(int width, size_t first = 1) {
+        _width = width < (int)max_size ? width : max_size;
+        memset(_text, '0', sizeof(_text));
+
+        size_t i = max_size;
+        do {
+            _text[--i] = char('0' + first % 10);
+            first /= 10;
+        } while (first && i > 0);
+        _digits_size = max_size - i;
+    }
+
+    const char* data() const { return _text + max_size - size(); }
+
+    size_t size() const { return _width > _digits_size ? _width : _digits_size; }
+
+    void next(){
+        size_t i = max_size - 1;
+        for (; _text[i] == '9' && i > 0; --i){
+            _text[i] = '0';
+        }
+        ++_text[i];
+        if (max_size - i > _digits_size){
+            _digits_size = max_size - i;
+        }
+    }
+
+private:
+    enum { max_size = 24 };
+
+    char    _text[max_size];
+    size_t  _width;
+    size_t  _digits_size;
+};
+
+static const html_escape_table html_escape(false);
+static const html_escape_table compact_escape(true);
+
+bool write_fd(int fd, const char* data, size_t size) {
+    while (size) {
+#ifdef _WIN32
+        int n = _write(fd, data, (unsigned int)size);
+#else
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void style_span_table::merge(style_class style){
+    if (_pending.empty()){
+        return;
+    }
+
+    std::sort(_pending.begin(), _pending.end(), begin_less());
+    _merge_begin.clear();
+    _merge_end.clear();
+    _merge_style.clear();
+
+    // last_end is the end of the last span kept, spans before it are final
+    size_t i = 0, last_end = 0;
+    std::vector<cc_reference>::const_iterator it;
+    for (it = _pending.begin(); it != _pending.end(); ++it){
+        for (; i < _begin.size() && _begin[i] < it->begin; ++i){
+            _push(_begin[i], _end[i], _style[i]);
+            last_end = _end[i];
+        }
+
+        if (it->begin >= it->end || it->begin < last_end){
+            continue;
+        }
+        if (i < _begin.size() && _begin[i] < it->end){
+            continue;
+        }
+        _push(it->begin, it->end, (unsigned char)style);
+        last_end = it->end;
+    }
+
+    _merge_begin.insert(_merge_begin.end(), _begin.begin() + i, _begin.end());
+    _merge_end.insert(_merge_end.end(), _end.begin() + i, _end.end());
+    _merge_style.insert(_merge_style.end(), _style.begin() + i, _style.end());
+    _begin.swap(_merge_begin);
+    _end.swap(_merge_end);
+    _style.swap(_merge_style);
+    _pending.clear();
+}
+
+void sort_symbols(style_span_table& spans, cc_symbol_index& symbols){
+    sort_preprocessor_list(spans, symbols.preprocessor_def_list(), style_preprocessor);
+    sort_name_def_list(spans, symbols.comment_def_list(), style_comment);
+    sort_name_def_list(spans, symbols.string_def_list(), style_string);
+    sort_name_def_list(spans, symbols.character_def_list(), style_character);
+    sort_name_def_list(spans, symbols.include_def_list(), style_string);
+    sort_reference_map(spans, symbols.external_type_ref_map(), style_external_type);
+    sort_reference_map(spans, symbols.external_scope_ref_map(), style_external_scope);
+    sort_reference_map(spans, symbols.keyword_ref_map(), style_keyword);
+    sort_reference_map(spans, symbols.class_ref_map(), style_user_type);
+    sort_reference_map(spans, symbols.enum_ref_map(), style_user_type);
+    sort_reference_map(spans, symbols.macro_ref_map(), style_macro);
+    sort_reference_map(spans, symbols.constant_ref_map(), style_enum_constant);
+    sort_reference_map(spans, symbols.method_ref_map(), style_method);
+}
+
+void sort_name_def_list(style_span_table& spans,
+                        const cc_name_def_list& def_list, style_class style){
+    cc_name_def_list::const_iterator it;
+    for (it = def_list.begin(); it != def_list.end(); ++it){
+        spans.add(it->name_ref);
+    }
+    spans.merge(style);
+}
+
+void sort_reference_map(style_span_table& spans,
+                        const cc_reference_view& ref_map, style_class style){
+    const cc_reference* it;
+    for (it = ref_map.begin(); it != ref_map.end(); ++it){
+        spans.add(*it);
+    }
+    spans.merge(style);
+}
+
+void sort_preprocessor_list(style_span_table& spans,
+                            const cc_preprocessor_def_list& proc_list, style_class style){
+    cc_preprocessor_def_list::const_iterator it;
+    for (it = proc_list.begin(); it != proc_list.end(); ++it){
+        // a directive without name, such as "# 1", only highlights the '#'
+        size_t end = it->name_ref.end > it->line_ref.begin ?
+            it->name_ref.end : it->line_ref.begin + 1;
+        spans.add(it->line_ref.begin, end);
+    }
+    spans.merge(style);
+}
+
+void html_writer::_write_slow(const char* s, size_t n){
+    while (n) {
+        size_t room = buffer_size - _size;
+        if (n < room) {
+            memcpy(_data + header_room + _size, s, n);
+            _size += n;
+            return;
+        }
+
+        memcpy(_data + header_room + _size, s, room);
+        _size = buffer_size;
+        s += room;
+        n -= room;
+        flush();
+    }
+}
+
+void html_writer::flush(){
+    if (_size == 0){
+        return;
+    }
+
+    char* begin = _data + header_room;
+    char* end = begin + _size;
+    if (_chunked){
+        char header[32];
+        int len = sprintf(header, "%lx\r\n", (unsigned long)_size);
+        begin -= len;
+        memcpy(begin, header, len);
+        *end++ = '\r';
+        *end++ = '\n';
+    }
+
+    _output(begin, end - begin);
+    _flushed += _size;
+    _size = 0;
+}
+
+bool html_writer::finish(){
+    flush();
+    if (_chunked){
+        _output("0\r\n\r\n", 5);
+    }
+    return !_failed;
+}
+
+void html_writer::_output(const char* s, size_t n){
+    if (_sink){
+        _sink->append(s, n);
+    }
+    else if (_output_fn){
+        if (!_failed && !_output_fn(_context, s, n)){
+            _failed = true;
+        }
+    }
+    else if (!_failed && !write_fd(_fd, s, n)){
+        _failed = true;
+    }
+}
+
+void begin_label(html_writer& buff, style_class idx){
+    buff.write(label_tags[idx].data, label_tags[idx].size);
+}
+
+void close_label(html_writer& buff){
+    buff.write("</label>", 8);
+}
+
+/// Summary
+///  The bytes [<from>, <to>) of the lines of ctl.first_line to ctl.last_line,
+/// returns the number of the first line
+///
+static size_t line_range(const cc_stream& src, const html_ctl& ctl, size_t& from, size_t& to){
+    size_t lines = src.line_count();
+    size_t first = ctl.first_line ? ctl.first_line : 1;
+    size_t last = ctl.last_line && ctl.last_line < lines ? ctl.last_line : lines;
+    from = first <= last ? src.line_begin(first - 1) : src.length();
+    to = first <= last ? src.line_end(last - 1) : src.length();
+    return first;
+}
+
+void source_to_html(cc_stream& src, html_writer& html,
+                    html_ctl& ctl, style_span_table& spans){
+    size_t from, to;
+    size_t first = line_range(src, ctl, from, to);
+
+    html_begin(html, ctl);
+    lines_to_html(src, html, ctl, spans, from, to, first);
+    html_end(html, ctl);
+}
+
+void source_to_spans(const cc_stream& src, html_writer& out, const html_ctl& ctl,
+                     const style_span_table& spans){
+    size_t from, to;
+    size_t first = line_range(src, ctl, from, to);
+
+    span_encoder encoder(out, ctl);
+    encoder.begin(ctl, first);
+    encoder.add(spans, from, to);
+    encoder.end();
+}
+
+/// Summary
+///  Size of the UTF-8 sequence at <s>, 0 if it is not one, <n> bytes are
+/// readable
+///
+static size_t utf8_length(const unsigned char* s, size_t n){
+    size_t size;
+    unsigned char low = 0x80, high = 0xBF;  // range of the second byte
+    if (s[0] >= 0xC2 && s[0] <= 0xDF){
+        size = 2;
+    }
+    else if (s[0] >= 0xE0 && s[0] <= 0xEF){
+        size = 3;
+        low = s[0] == 0xE0 ? 0xA0 : 0x80;       // no overlong forms
+        high = s[0] == 0xED ? 0x9F : 0xBF;      // no surrogates
+    }
+    else if (s[0] >= 0xF0 && s[0] <= 0xF4){
+        size = 4;
+        low = s[0] == 0xF0 ? 0x90 : 0x80;
+        high = s[0] == 0xF4 ? 0x8F : 0xBF;      // up to U+10FFFF
+    }
+    else {
+        return 0;
+    }
+
+    if (n < size || s[1] < low || s[1] > high){
+        return 0;
+    }
+    for (size_t i = 2; i < size; ++i){
+        if (s[i] < 0x80 || s[i] > 0xBF){
+            return 0;
+        }
+    }
+    return size;
+}
+
+void span_encoder::begin(const html_ctl& ctl, size_t first_line){
+    if (!_json){
+        _out.write("BCS1", 4);
+        _varint(first_line);
+        return;
+    }
+
+    // bytes that are not UTF-8 are taken as Latin-1, the JSON stays valid
+    _out += "{\"title\":\"";
+    const unsigned char* title = (const unsigned char*)ctl.title.data();
+    size_t size = ctl.title.size();
+    for (size_t i = 0; i < size; ){
+        unsigned char c = title[i];
+        size_t n = c >= 0x80 ? utf8_length(title + i, size - i) : 1;
+        if (c == '"' || c == '\\'){
+            _out.put('\\');
+            _out.put((char)c);
+        }
+        else if (c < 0x20 || n == 0){
+            char text[8];
+            sprintf(text, "\\u%04x", c);
+            _out += text;
+            n = 1;
+        }
+        else {
+            _out.write((const char*)title + i, n);
+        }
+        i += n;
+    }
+    _out += "\",\"line\":";
+    _number(first_line);
+    _out += ",\"styles\":[";
+    for (size_t i = 0; i < sizeof(label_tags) / sizeof(label_tags[0]); ++i){
+        _out += i ? ",\"" : "\"";
+        _out += label_tags[i].name;
+        _out.put('"');
+    }
+    _out += "],\"spans\":[";
+}
+
+void span_encoder::add(const style_span_table& spans, size_t from, size_t to){
+    size_t label = 0;
+    size_t label_count = spans.size();
+    while (label < label_count && spans.end(label) <= from){
+        ++label;
+    }
+
+    // spans running into or past the bytes are cut at their ends
+    for (; label < label_count && spans.begin(label) < to; ++label){
+        size_t begin = _offset + std::max(spans.begin(label), from) - from;
+        size_t end = _offset + std::min(spans.end(label), to) - from;
+        if (_json){
+            if (_count++){
+                _out.put(',');
+            }
+            _number(begin - _last_end);
+            _out.put(',');
+            _number(end - begin);
+            _out.put(',');
+            _number(spans.style(label));
+        }
+        else {
+            _varint((begin - _last_end) << 4 | spans.style(label));
+            _varint(end - begin);
+        }
+        _last_end = end;
+    }
+    _offset += to - from;
+}
+
+void span_encoder::end(){
+    if (_json){
+        _out += "]}\n";
+    }
+}
+
+void span_encoder::_varint(size_t value){
+    char* out = _out.reserve(16);
+    while (value >= 0x80){
+        *out++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (char)value;
+    _out.commit(out);
+}
+
+void span_encoder::_number(size_t value){
+    char text[24];
+    size_t i = sizeof(text);
+    do {
+        text[--i] = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    _out.write(text + i, sizeof(text) - i);
+}
+
+void html_begin(html_writer& html, const html_ctl& ctl){
+    if (ctl.compact){
+        if (!ctl.no_header){
+            html += "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>";
+            html += ctl.title;
+            html += "</title>\n<link rel=\"stylesheet\" href=\"";
+            html += ctl.style;
+            html += "\">\n</head>\n<body>\n";
+        }
+
+        char text[64];
+        sprintf(text, "<pre style=\"white-space:pre;tab-size:%d\">", ctl.tab_size);
+        html += "<!--This document is generated by BLING-C https://github.com/algoriz/blingc -->\n";
+        html += text;
+        return;
+    }
+
+    if (!ctl.no_header){
+        html += "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\" "
+            "\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">\n"
+            "<html xmlns=\"http://www.w3.org/1999/xhtml\">\n<head>\n<title>";
+        html += ctl.title;
+        html += "</title>\n<link rel=\"stylesheet\" href=\"";
+        html += ctl.style;
+        html += "\" type=\"text/css\"/>\n</head>\n<body>\n";
+    }
+
+    // output HTML contents
+    html += "<!--This document is generated by BLING-C https://github.com/algoriz/blingc -->\n";
+}
+
+void html_end(html_writer& html, const html_ctl& ctl){
+    if (ctl.compact){
+        html += "</pre>";
+    }
+    if (!ctl.no_header){
+        html += "\n</body>\n</html>\n";
+    }
+}
+
+/// Summary
+///  Whether the bytes of <data> in [<begin>, <end>) are all whitespace, which
+/// may take the style of the spans around them without showing it
+///
+static bool is_joint(const char* data, size_t begin, size_t end){
+    for (; begin < end; ++begin){
+        if (!compact_escape.joint[(unsigned char)data[begin]]){
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Summary
+///  Write the line number <lno> of line <line>, blank unless <line> is a
+/// multiple of ctl.lno_step, a step below 1 numbers every line
+///
+static void write_line_number(html_writer& html, const html_ctl& ctl, const label_tag& tag,
+                              const line_number_text& lno, size_t line){
+    html.write(tag.data, tag.size);
+    if (ctl.lno_step <= 1 || line % ctl.lno_step == 0){
+        html.write(lno.data(), lno.size());
+    }
+    else if (ctl.compact){
+        html.append(lno.size(), ' ');
+    }
+    else {
+        for (size_t i = 0; i < lno.size(); ++i){
+            html.write("&nbsp;", 6);
+        }
+    }
+    if (ctl.compact){
+        html.write("</span>", 7);
+    }
+    else {
+        html.write("</label>", 8);
+    }
+}
+
+/// Summary
+///  lines_to_html() for ctl.compact
+///
+///  Whitespace is written as it is, and spans of one style separated by
+/// whitespace only are merged into one <span>, a line number then shows
+/// inside it as in a comment of several lines. Spans are merged within
+/// [<from>, <to>) only, so lines rendered in pieces may get more tags.
+/// Line numbers, with ctl.lno_size, are the only markup written per line.
+///
+static void lines_to_compact(const cc_stream& src, html_writer& html, const html_ctl& ctl,
+                             const style_span_table& spans, size_t from, size_t to,
+                             size_t number){
+    line_number_text lno(ctl.lno_size, number);
+    size_t line = number;
+    bool add_line_num = (ctl.lno_size != 0);
+
+    const char* data = src.content();
+    size_t label = 0;
+    size_t label_count = spans.size();
+    size_t open_end = 0;    // end of the open span, 0 if none
+    while (label < label_count && spans.end(label) <= from){
+        ++label;
+    }
+
+    const size_t max_block = html_writer::buffer_size / html_escape_table::text_size;
+    size_t gp = from;
+    while (gp < to){
+        if (add_line_num){
+            write_line_number(html, ctl, span_tags[style_line_number], lno, line);
+            add_line_num = false;
+        }
+
+        if (open_end && gp == open_end){
+            html.write("</span>", 7);
+            open_end = 0;
+        }
+
+        if (!open_end && label < label_count && gp == std::max(spans.begin(label), from)){
+            style_class style = spans.style(label);
+            html.write(span_tags[style].data, span_tags[style].size);
+            open_end = spans.end(label++);
+            while (label < label_count && spans.style(label) == style
+                   && is_joint(data, open_end, spans.begin(label))){
+                open_end = spans.end(label++);
+            }
+        }
+
+        // render up to the next span boundary, at most one buffer at a time
+        size_t stop = open_end ? open_end : label < label_count ? spans.begin(label) : to;
+        if (stop > to){
+            stop = to;
+        }
+        if (stop - gp > max_block){
+            stop = gp + max_block;
+        }
+
+        char* out = html.reserve((stop - gp) * html_escape_table::text_size);
+        for (; gp < stop; ++gp){
+            unsigned char c = (unsigned char)data[gp];
+            if (compact_escape.stop[c]){
+                break;
+            }
+            memcpy(out, compact_escape.text[c], html_escape_table::text_size);
+            out += compact_escape.size[c];
+        }
+        html.commit(out);
+
+        if (gp == stop){
+            continue;
+        }
+
+        ++gp;
+        html.put('\n');
+        lno.next();
+        ++line;
+        add_line_num = (ctl.lno_size != 0);
+    }
+
+    // A span running past the lines is closed where they end
+    if (open_end){
+        html.write("</span>", 7);
+    }
+}
+
+/// Summary
+///  Render the lines of <src> in [<from>, <to>), the first one numbered
+/// <number>
+///
+///  Both ends are where a line begins, or the end of <src>, unless a line is
+/// too long to wait for. A document may be made of the lines of several
+/// streams rendered one after another between html_begin() and html_end().
+///
+void lines_to_html(const cc_stream& src, html_writer& html, const html_ctl& ctl,
+                   const style_span_table& spans, size_t from, size_t to, size_t number){
+    if (ctl.compact){
+        lines_to_compact(src, html, ctl, spans, from, to, number);
+        return;
+    }
+
+    line_number_text lno(ctl.lno_size, number);
+    size_t line = number;
+    bool add_line_num = (ctl.lno_size != 0);
+
+    const char* data = src.content();
+    size_t label = 0;
+    size_t label_count = spans.size();
+    size_t tab_col = 0;
+
+    // A span running into the lines is opened where they begin
+    while (label < label_count && spans.end(label) <= from){
+        ++label;
+    }
+
+    const size_t max_block = html_writer::buffer_size / html_escape_table::text_size;
+    size_t length = to;
+    size_t gp = from;
+    while (gp < length){
+        if (add_line_num) {
+            write_line_number(html, ctl, label_tags[style_line_number], lno, line);
+            add_line_num = false;
+            tab_col = 0;
+        }
+
+        if ((label < label_count) && (gp == spans.end(label))) {
+            close_label(html);
+            ++label;
+        }
+
+        if ((label < label_count) && (gp == std::max(spans.begin(label), from))) {
+            begin_label(html, spans.style(label));
+        }
+
+        // render up to the next label boundary, at most one buffer at a time
+        size_t stop = length;
+        if (label < label_count) {
+            stop = gp < spans.begin(label) ? spans.begin(label) : spans.end(label);
+        }
+        if (stop > length){
+            stop = length;
+        }
+        if (stop - gp > max_block){
+            stop = gp + max_block;
+        }
+
+        char* out = html.reserve((stop - gp) * html_escape_table::text_size);
+        for (; gp < stop; ++gp){
+            unsigned char c = (unsigned char)data[gp];
+            if (html_escape.stop[c]){
+                break;
+            }
+            memcpy(out, html_escape.text[c], html_escape_table::text_size);
+            out += html_escape.size[c];
+            tab_col += html_escape.column[c];
+        }
+        html.commit(out);
+
+        if (gp == stop){
+            continue;
+        }
+
+        if (data[gp++] == '\t'){
+            if (ctl.tab_size > (int)(tab_col % 4)) {
+                html.append(ctl.tab_size - (tab_col % 4), ' ');
+            }
+            tab_col = 0;
+        }
+        else {
+            html.write("<br/>", 5);
+            lno.next();
+            ++line;
+            if (ctl.lno_size){
+                add_line_num = true;
+            }
+        }
+    }
+
+    // A span running past the lines is closed where they end
+    if (to < src.length() && label < label_count
+        && std::max(spans.begin(label), from) < to){
+        close_label(html);
+    }
+}
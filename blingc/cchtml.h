@@ -0,0 +1,265 @@
+#pragma once
+
+#include "cclex.h"
+#include <string>
+#include <vector>
+
+enum style_class {
+    style_line_number,
+
+    style_identifier,
+    style_keyword,
+    style_user_type,    // style for user classes and enum types
+    style_external_type,
+    style_external_scope,
+    style_method,
+    style_macro,
+    style_enum_constant,
+    style_comment,
+    style_string,
+    style_character,
+    style_preprocessor
+};
+
+/// Summary
+///  Flat table of styled spans, sorted by position and free of overlaps
+///
+///  Spans of one style are collected by add() and folded into the table by
+/// merge(). A span overlapping a span already in the table is dropped, so
+/// styles merged first take precedence, as with inserting into a std::set
+/// ordered by cc_reference::less.
+///
+class style_span_table {
+public:
+    size_t size() const { return _begin.size(); }
+    size_t begin(size_t i) const { return _begin[i]; }
+    size_t end(size_t i) const { return _end[i]; }
+    style_class style(size_t i) const { return (style_class)_style[i]; }
+
+    void add(size_t begin, size_t end){
+        _pending.push_back(cc_reference(begin, end));
+    }
+
+    void add(const cc_reference& ref){
+        _pending.push_back(ref);
+    }
+
+    void merge(style_class style);
+
+    void clear(){
+        _begin.clear();
+        _end.clear();
+        _style.clear();
+        _pending.clear();
+    }
+
+private:
+    struct begin_less {
+        bool operator()(const cc_reference& l, const cc_reference& r) const {
+            return l.begin < r.begin;
+        }
+    };
+
+    void _push(size_t begin, size_t end, unsigned char style){
+        _merge_begin.push_back(begin);
+        _merge_end.push_back(end);
+        _merge_style.push_back(style);
+    }
+
+    std::vector<size_t>         _begin;
+    std::vector<size_t>         _end;
+    std::vector<unsigned char>  _style;
+
+    // scratch space of merge(), kept to reuse its capacity
+    std::vector<cc_reference>   _pending;
+    std::vector<size_t>         _merge_begin;
+    std::vector<size_t>         _merge_end;
+    std::vector<unsigned char>  _merge_style;
+};
+
+enum output_format {
+    format_html,
+    format_spans,       // binary spans, see span_encoder
+    format_json         // the same spans as JSON
+};
+
+struct html_ctl{
+    html_ctl()
+        : style("style.css"), lno_size(0), lno_step(1), tab_size(4), no_header(0),
+          std_chunk(0), first_line(0), last_line(0), format(format_html), compact(0) {}
+
+    std::string title;
+    std::string style;
+    int lno_size;           // digits of line numbers, 0 for none
+    int lno_step;           // >= 1, lines numbered, the others get a blank number
+    int tab_size;           // >= 1
+    int no_header;
+    int std_chunk;
+    size_t first_line;      // lines to render, counted from 1, 0 for no limit
+    size_t last_line;
+    int format;             // output_format
+    int compact;            // literal whitespace in a <pre>, short tags
+    std::string cache_dir;  // ends with a path separator, empty without cache
+};
+
+/// Summary
+///  Receives the output of an html_writer, returns false to fail the writer
+///
+typedef bool (*html_output)(void* context, const char* data, size_t size);
+
+/// Summary
+///  Buffered HTML output with constant memory
+///
+///  Content is collected in a fixed-size buffer which is written to a file
+/// descriptor, appended to a string, or passed to a callback every time it
+/// fills up. In chunked mode each flush is framed as an HTTP chunk, and
+/// finish() terminates the document with the zero-size chunk.
+///
+class html_writer {
+public:
+    enum { buffer_size = 64 * 1024 };
+
+    html_writer(int fd, bool chunked)
+        : _fd(fd), _sink(0), _output_fn(0), _context(0), _chunked(chunked),
+          _failed(false), _size(0), _flushed(0) {}
+
+    html_writer(std::string* sink, bool chunked)
+        : _fd(-1), _sink(sink), _output_fn(0), _context(0), _chunked(chunked),
+          _failed(false), _size(0), _flushed(0) {}
+
+    html_writer(html_output output, void* context, bool chunked)
+        : _fd(-1), _sink(0), _output_fn(output), _context(context), _chunked(chunked),
+          _failed(false), _size(0), _flushed(0) {}
+
+    void write(const char* s, size_t n){
+        if (n <= buffer_size - _size){
+            memcpy(_data + header_room + _size, s, n);
+            _size += n;
+        }
+        else {
+            _write_slow(s, n);
+        }
+    }
+
+    /// Space to write at least <n> bytes in place, n <= buffer_size
+    char* reserve(size_t n){
+        if (n > buffer_size - _size){
+            flush();
+        }
+        return _data + header_room + _size;
+    }
+
+    /// Commit bytes written in place up to <end>
+    void commit(char* end){
+        _size = end - (_data + header_room);
+    }
+
+    void append(size_t n, char c){
+        while (n--) {
+            put(c);
+        }
+    }
+
+    void put(char c){
+        if (_size == buffer_size){
+            flush();
+        }
+        _data[header_room + _size++] = c;
+    }
+
+    html_writer& operator+=(const char* s){
+        write(s, strlen(s));
+        return *this;
+    }
+
+    html_writer& operator+=(const std::string& s){
+        write(s.data(), s.size());
+        return *this;
+    }
+
+    /// Bytes of content written so far, chunk framing excluded
+    size_t written() const { return _flushed + _size; }
+
+    /// Write out the buffered content
+    void flush();
+
+    /// Flush and end the document, returns false if any write failed
+    bool finish();
+
+private:
+    // room for the chunk header in front of the buffer, and the CRLF behind
+    enum { header_room = 16, trailer_room = 2 };
+
+    void _write_slow(const char* s, size_t n);
+
+    void _output(const char* s, size_t n);
+
+    int             _fd;
+    std::string*    _sink;
+    html_output     _output_fn;
+    void*           _context;
+    bool            _chunked;
+    bool            _failed;
+    size_t          _size;
+    size_t          _flushed;
+    char            _data[header_room + buffer_size + trailer_room];
+};
+
+/// Summary
+///  Styled spans of a document, for the viewers that render the source
+/// themselves
+///
+///  Each span is the triple (gap, length, style), where gap is the number of
+/// bytes from the end of the previous span, or from the beginning of the first
+/// line rendered, to the beginning of the span, and style is a style_class.
+/// Lengths are in bytes of the source, line breaks included.
+///
+///  format_spans is the magic "BCS1" and the number of the first line as a
+/// varint, then a varint of gap * 16 + style and a varint of length for each
+/// span, up to the end of the document. Varints are 7 bits a byte, low bits
+/// first, the high bit set on all bytes but the last. format_json is an
+/// object with "title", "line", the class names of the styles in "styles"
+/// and the triples one after another in the array "spans".
+///
+class span_encoder {
+public:
+    span_encoder(html_writer& out, const html_ctl& ctl)
+        : _out(out), _json(ctl.format == format_json), _offset(0), _last_end(0),
+          _count(0) {}
+
+    /// Write the header of a document starting at line <first_line>
+    void begin(const html_ctl& ctl, size_t first_line);
+
+    /// Write the spans in [<from>, <to>) of <spans>, which follows the bytes
+    /// added before
+    void add(const style_span_table& spans, size_t from, size_t to);
+
+    /// Write the end of the document
+    void end();
+
+private:
+    void _varint(size_t value);
+    void _number(size_t value);
+
+    html_writer&    _out;
+    bool            _json;
+    size_t          _offset;    // bytes added so far
+    size_t          _last_end;  // end of the last span, counted as _offset
+    size_t          _count;
+};
+
+/// Write all <size> bytes to <fd>, returns false if a write fails
+bool write_fd(int fd, const char* data, size_t size);
+
+void sort_symbols(style_span_table& spans, cc_symbol_index& symbols);
+void sort_name_def_list(style_span_table& spans, const cc_name_def_list& ref_set, style_class c);
+void sort_reference_map(style_span_table& spans, const cc_reference_view& ref_map, style_class c);
+void source_to_html(cc_stream& src, html_writer& html, html_ctl& ctl, style_span_table& spans);
+void source_to_spans(const cc_stream& src, html_writer& out, const html_ctl& ctl,
+                     const style_span_table& spans);
+void html_begin(html_writer& html, const html_ctl& ctl);
+void html_end(html_writer& html, const html_ctl& ctl);
+void lines_to_html(const cc_stream& src, html_writer& html, const html_ctl& ctl,
+                   const style_span_table& spans, size_t from, size_t to, size_t number);
+void sort_preprocessor_list(style_span_table& spans,
+                            const cc_preprocessor_def_list& proc_list, style_class style);
@@ -2,6 +2,33 @@
 
 #include <fstream>
 #include <algorithm>
+#include <deque>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define CC_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define CC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CC_TARGET_AVX2
+#endif
 
 using namespace std;
 
@@ -33,75 +60,664 @@ inline bool is_identifier(char ch) {
     return is_lower(ch) || is_upper(ch) || ch == '_';
 }
 
-char cc_keyword_set::_keywords[128][32] =
-{
-    "auto", "const", "double", "float", "int", "short", "struct", "unsigned",
-    "break", "continue", "else", "for", "long", "signed", "switch", "void",
-    "case", "default", "enum", "goto", "register", "sizeof", "typedef",
-    "volatile", "char", "do", "extern", "if", "return", "static", "union",
-    "while", "asm", "dynamic_cast", "namespace", "reinterpret_cast", "try",
-    "bool", "explicit", "new", "static_cast", "typeid", "catch", "false",
-    "operator", "template", "typename", "class", "friend", "private", "this",
-    "using", "const_cast", "inline", "public", "throw", "virtual", "delete",
-    "mutable", "protected", "true", "wchar_t", 0
+/// Summary
+///  Byte classes used by the fused lexer to skip over the bytes that a DFA
+/// ignores in its current state
+///
+enum cc_char_flag {
+    ccf_comment      = 0x01,    // '/', '"' and '\\', outside of comments
+    ccf_string       = 0x02,    // '"' and '\\'
+    ccf_character    = 0x04,    // '\'' and '\\'
+    ccf_preprocessor = 0x08,    // '\\' and LF, also ending line comments
+    ccf_identifier   = 0x10,    // first character of an identifier
+    ccf_separator    = 0x20,    // character that ends an identifier
+    ccf_non_space    = 0x40,
+    ccf_bracket      = 0x80     // brackets matched by cc_stream::index_pairs
+};
+
+/// Summary
+///  Returns the first position in [<p>, <end>) holding one of the bytes of
+/// <set>, or the position where less than a vector is left to read
+///
+typedef size_t (*cc_scan_fn)(const char* data, size_t p, size_t end, const unsigned char* set);
+
+#ifdef CC_SIMD_X86
+inline unsigned first_bit(unsigned bits) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, bits);
+    return i;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+template <int N>
+size_t scan_sse2(const char* data, size_t p, size_t end, const unsigned char* set) {
+    __m128i v[N ? N : 1];
+    for (int i = 0; i < N; ++i) {
+        v[i] = _mm_set1_epi8((char)set[i]);
+    }
+
+    for (; p + 16 <= end; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + p));
+        __m128i m = _mm_setzero_si128();
+        for (int i = 0; i < N; ++i) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(x, v[i]));
+        }
+
+        unsigned bits = (unsigned)_mm_movemask_epi8(m);
+        if (bits) {
+            return p + first_bit(bits);
+        }
+    }
+    return p;
+}
+
+template <int N> CC_TARGET_AVX2
+size_t scan_avx2(const char* data, size_t p, size_t end, const unsigned char* set) {
+    __m256i v[N ? N : 1];
+    for (int i = 0; i < N; ++i) {
+        v[i] = _mm256_set1_epi8((char)set[i]);
+    }
+
+    for (; p + 32 <= end; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + p));
+        __m256i m = _mm256_setzero_si256();
+        for (int i = 0; i < N; ++i) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, v[i]));
+        }
+
+        unsigned bits = (unsigned)_mm256_movemask_epi8(m);
+        if (bits) {
+            return p + first_bit(bits);
+        }
+    }
+    return scan_sse2<N>(data, p, end, set);
+}
+
+static const cc_scan_fn sse2_scans[] = {
+    scan_sse2<0>, scan_sse2<1>, scan_sse2<2>, scan_sse2<3>, scan_sse2<4>,
+    scan_sse2<5>, scan_sse2<6>, scan_sse2<7>, scan_sse2<8>
+};
+
+static const cc_scan_fn avx2_scans[] = {
+    scan_avx2<0>, scan_avx2<1>, scan_avx2<2>, scan_avx2<3>, scan_avx2<4>,
+    scan_avx2<5>, scan_avx2<6>, scan_avx2<7>, scan_avx2<8>
 };
 
-cc_keyword_set::cc_keyword_set() {
-    for (size_t i = 0; i < 128 && _keywords[i][0]; ++i) {
-        insert(_keywords[i]);
+/// Summary
+///  Append the position after each LF in [<p>, <end>) to <lines>, returns
+/// where less than a vector is left to read
+///
+static size_t line_starts_sse2(const char* data, size_t p, size_t end,
+                               std::vector<size_t>& lines) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + p));
+        unsigned bits = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, lf));
+        for (; bits; bits &= bits - 1) {
+            lines.push_back(p + first_bit(bits) + 1);
+        }
+    }
+    return p;
+}
+
+static CC_TARGET_AVX2 size_t line_starts_avx2(const char* data, size_t p, size_t end,
+                                              std::vector<size_t>& lines) {
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + p));
+        unsigned bits = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, lf));
+        for (; bits; bits &= bits - 1) {
+            lines.push_back(p + first_bit(bits) + 1);
+        }
+    }
+    return line_starts_sse2(data, p, end, lines);
+}
+#endif
+
+static cc_simd::level detect_simd() {
+#if defined(CC_SIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? cc_simd::avx2 : cc_simd::sse2;
+#elif defined(CC_SIMD_X86) && defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] >= 7) {
+        __cpuid(r, 1);
+        bool avx = (r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+        __cpuidex(r, 7, 0);
+        if (avx && (r[1] & (1 << 5))) {
+            return cc_simd::avx2;
+        }
+    }
+    return cc_simd::sse2;
+#else
+    return cc_simd::scalar;
+#endif
+}
+
+static const cc_scan_fn* scans_of(cc_simd::level level) {
+#ifdef CC_SIMD_X86
+    switch (level) {
+    case cc_simd::sse2: return sse2_scans;
+    case cc_simd::avx2: return avx2_scans;
+    default: break;
     }
+#endif
+    return 0;
 }
 
-char cc_class_key_set::_class_key[3][8] = { "class", "struct", "union" };
+// Scanners in use, indexed by the size of the byte set. Streams parsed before
+//these are initialized are scanned by the scalar path.
+static const cc_simd::level simd_supported = detect_simd();
+static cc_simd::level simd_level = simd_supported;
+static const cc_scan_fn* simd_scans = scans_of(simd_level);
+
+cc_simd::level cc_simd::supported() {
+    return simd_supported;
+}
 
-cc_class_key_set::cc_class_key_set() {
-    for (int i = 0; i < 3; ++i) {
-        insert(_class_key[i]);
+cc_simd::level cc_simd::current() {
+    return simd_level;
+}
+
+cc_simd::level cc_simd::select(level max) {
+    simd_level = max < simd_supported ? max : simd_supported;
+    simd_scans = scans_of(simd_level);
+    return simd_level;
+}
+
+/// Summary
+///  Append the position after each LF in [<p>, <end>) to <lines>
+///
+static void line_starts(const char* data, size_t p, size_t end, std::vector<size_t>& lines) {
+#ifdef CC_SIMD_X86
+    switch (simd_level) {
+    case cc_simd::sse2: p = line_starts_sse2(data, p, end, lines); break;
+    case cc_simd::avx2: p = line_starts_avx2(data, p, end, lines); break;
+    default: break;
     }
+#endif
+    for (const char* lf; p < end && (lf = (const char*)memchr(data + p, '\n', end - p)); ) {
+        p = lf - data + 1;
+        lines.push_back(p);
+    }
+}
 
-    insert("namespace");
+const char* cc_simd::name(level l) {
+    switch (l) {
+    case sse2: return "sse2";
+    case avx2: return "avx2";
+    default: return "scalar";
+    }
 }
 
-char cc_base_specifier_set::_base_specifier[4][16] = {
-    "public", "protected", "private", 0
+struct cc_char_class {
+    enum { max_set_size = 8, probe_size = 8 };
+
+    cc_char_class() {
+        for (int ch = 0; ch < 256; ++ch) {
+            unsigned char f = 0;
+            switch (ch) {
+            case '/': f |= ccf_comment; break;
+            case '\n': f |= ccf_preprocessor; break;
+            case '\"': f |= ccf_comment | ccf_string; break;
+            case '\'': f |= ccf_character; break;
+            case '\\':
+                f |= ccf_comment | ccf_string | ccf_character | ccf_preprocessor;
+                break;
+            case '(': case ')': case '[': case ']':
+            case '{': case '}': case '<': case '>':
+                f |= ccf_bracket;
+                break;
+            }
+            if (is_identifier(char(ch))) { f |= ccf_identifier; }
+            if (is_separator(char(ch)))  { f |= ccf_separator; }
+            if (!is_whitespace(char(ch))){ f |= ccf_non_space; }
+            flags[ch] = f;
+        }
+
+        for (int mask = 0; mask < 256; ++mask) {
+            set_size[mask] = 0;
+            for (int ch = 0; ch < 256; ++ch) {
+                if (!(flags[ch] & mask)) {
+                    continue;
+                }
+                if (set_size[mask] == max_set_size) {
+                    set_size[mask] = max_set_size + 1;
+                    break;
+                }
+                set_bytes[mask][set_size[mask]++] = (unsigned char)ch;
+            }
+        }
+    }
+
+    /// Summary
+    ///  Returns the first position in [<p>, <end>) whose byte has any of
+    /// <mask> set, or <end> if there is none
+    ///
+    ///  Masks held by a few bytes only are scanned a vector at a time.
+    ///
+    size_t skip(const char* data, size_t p, size_t end, unsigned char mask) const {
+        // the next byte is often near, look at a few before setting up vectors
+        size_t probe = end - p > probe_size ? p + probe_size : end;
+        for (; p < probe; ++p) {
+            if (flags[(unsigned char)data[p]] & mask) {
+                return p;
+            }
+        }
+
+        if (simd_scans && set_size[mask] <= max_set_size && p + 16 <= end) {
+            p = simd_scans[set_size[mask]](data, p, end, set_bytes[mask]);
+        }
+        for (; p < end && !(flags[(unsigned char)data[p]] & mask); ++p);
+        return p;
+    }
+
+    unsigned char flags[256];
+    unsigned char set_bytes[256][max_set_size];     // bytes having each mask
+    unsigned char set_size[256];                    // max_set_size + 1 if more
 };
 
-cc_base_specifier_set::cc_base_specifier_set() {
-    for (size_t i = 0; i < 3; ++i) {
-        insert(_base_specifier[i]);
+static const cc_char_class char_class;
+
+uint32_t cc_word_set::hash(uint32_t seed, const char* s, size_t n){
+    uint32_t h = seed ^ (uint32_t)n;
+    for (size_t i = 0; i < n; ++i){
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+bool cc_word_set::count(const char* s, size_t n) const {
+    if (n == 0 || n > max_length){
+        return false;
+    }
+
+    unsigned char slot = slots[hash(seed, s, n) & slot_mask];
+    if (slot == 0){
+        return false;
+    }
+
+    const cc_word& word = words[slot - 1];
+    return word.length == n && memcmp(word.text, s, n) == 0;
+}
+
+void cc_arena::reset(){
+    _current = _first;
+    _used = 0;
+    _ptr = _end = 0;
+    if (_current){
+        _ptr = (char*)_current + header_size;
+        _end = (char*)_current + _current->size;
+    }
+}
+
+void cc_arena::release(){
+    while (_first){
+        block* next = _first->next;
+        ::operator delete(_first);
+        _first = next;
+    }
+    _current = 0;
+    _ptr = _end = 0;
+    _used = 0;
+    _reserved = 0;
+}
+
+/// Summary
+///  Move on to the next block, a new one is put in front of it if it is
+/// missing or too small for <size>
+///
+void cc_arena::_grow(size_t size){
+    block* next = _current ? _current->next : _first;
+    if (!next || next->size < header_size + size){
+        size_t block_size = first_block;
+        if (_current){
+            block_size = std::min<size_t>(2 * _current->size, block_limit);
+        }
+        block_size = std::max<size_t>(block_size, header_size + size);
+
+        block* b = (block*)::operator new(block_size);
+        b->next = next;
+        b->size = block_size;
+        if (_current){
+            _current->next = b;
+        }
+        else{
+            _first = b;
+        }
+        _reserved += block_size;
+        next = b;
+    }
+
+    _current = next;
+    _ptr = (char*)next + header_size;
+    _end = (char*)next + next->size;
+}
+
+const size_t cc_name_pool::npos;
+const size_t cc_reference_table::npos;
+const size_t cc_reference_view::npos;
+
+size_t cc_name_pool::intern(const char* s, size_t n){
+    if (_slots.size() < 2 * (size() + 1)){
+        _grow();
+    }
+
+    uint32_t h = cc_word_set::hash(0, s, n);
+    size_t slot = _probe(s, n, h);
+    if (_slots[slot]){
+        return _slots[slot] - 1;
+    }
+
+    size_t id = size();
+    _slots[slot] = (uint32_t)(id + 1);
+    _hashes.push_back(h);
+    _text.insert(_text.end(), s, s + n);
+    _text.push_back('\0');
+    _offsets.push_back(_text.size());
+    return id;
+}
+
+size_t cc_name_pool::find(const char* s, size_t n) const{
+    if (_slots.empty()){
+        return npos;
+    }
+
+    size_t slot = _probe(s, n, cc_word_set::hash(0, s, n));
+    return _slots[slot] ? _slots[slot] - 1 : npos;
+}
+
+void cc_name_pool::clear(){
+    _text.clear();
+    _offsets.assign(1, 0);
+    _hashes.clear();
+    _slots.clear();
+}
+
+/// Summary
+///  Returns the slot that holds the name, or the empty slot where it goes
+///
+size_t cc_name_pool::_probe(const char* s, size_t n, uint32_t h) const{
+    size_t mask = _slots.size() - 1;
+    for (size_t slot = h & mask;; slot = (slot + 1) & mask){
+        uint32_t id = _slots[slot];
+        if (id == 0 || (_hashes[id - 1] == h && length(id - 1) == n
+                        && memcmp(data(id - 1), s, n) == 0)){
+            return slot;
+        }
+    }
+}
+
+/// Summary
+///  Double the slots, the table is kept at most half full
+///
+void cc_name_pool::_grow(){
+    size_t slot_count = _slots.empty() ? 256 : _slots.size() * 2;
+    _slots.assign(slot_count, 0);
+
+    size_t mask = slot_count - 1;
+    for (size_t id = 0; id < _hashes.size(); ++id){
+        size_t slot = _hashes[id] & mask;
+        while (_slots[slot]){
+            slot = (slot + 1) & mask;
+        }
+        _slots[slot] = (uint32_t)(id + 1);
     }
 }
 
-char cc_access_specifier_set::_access_specifier[2][16] = {
-    "const", 0
+/// Summary
+///  Orders groups by their names, as std::string does
+///
+struct cc_reference_table::name_less {
+    explicit name_less(const cc_name_pool& n): names(n) {}
+
+    bool operator()(const group& l, const group& r) const {
+        size_t ll = names.length(l.id), rl = names.length(r.id);
+        int c = memcmp(names.data(l.id), names.data(r.id), min(ll, rl));
+        return c < 0 || (c == 0 && ll < rl);
+    }
+
+    const cc_name_pool& names;
 };
 
-cc_access_specifier_set::cc_access_specifier_set() {
-    for (size_t i = 0; i < 1; ++i) {
-        insert(_access_specifier[i]);
+static bool reference_before(const cc_reference& l, const cc_reference& r){
+    return l.begin < r.begin;
+}
+
+void cc_reference_table::erase(const std::vector<bool>& ids){
+    _unseal();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < _postings.size(); ++i){
+        size_t id = _postings[i].id;
+        if (id < ids.size() && ids[id]){
+            _present[id] = false;
+        }
+        else{
+            _postings[kept++] = _postings[i];
+        }
+    }
+    _postings.erase(_postings.begin() + kept, _postings.end());
+}
+
+void cc_reference_table::seal(const cc_name_pool& names){
+    if (_postings.empty()){
+        return;
+    }
+    _unseal();
+
+    // Counting sort by name id, references of a name keep their insertion order
+    std::vector<size_t> first(_present.size() + 1, 0);
+    for (size_t i = 0; i < _postings.size(); ++i){
+        ++first[_postings[i].id + 1];
+    }
+    for (size_t id = 1; id < first.size(); ++id){
+        first[id] += first[id - 1];
+    }
+
+    std::vector<size_t> next(first.begin(), first.end() - 1);
+    std::vector<cc_reference> sorted(_postings.size());
+    for (size_t i = 0; i < _postings.size(); ++i){
+        sorted[next[_postings[i].id]++] = _postings[i].ref;
+    }
+    std::vector<posting>().swap(_postings);
+
+    _groups.clear();
+    for (size_t id = 0; id + 1 < first.size(); ++id){
+        if (first[id + 1] > first[id]){
+            _groups.push_back(group(id, first[id], first[id + 1]));
+        }
+    }
+    sort(_groups.begin(), _groups.end(), name_less(names));
+
+    // Lay the groups out in name order, references by position
+    _refs.clear();
+    _refs.reserve(sorted.size());
+    for (size_t g = 0; g < _groups.size(); ++g){
+        size_t begin = _refs.size();
+        sort(sorted.begin() + _groups[g].first, sorted.begin() + _groups[g].last,
+             reference_before);
+        for (size_t i = _groups[g].first; i < _groups[g].last; ++i){
+            if (_refs.size() == begin || _refs.back().end <= sorted[i].begin){
+                _refs.push_back(sorted[i]);
+            }
+        }
+        _groups[g].first = begin;
+        _groups[g].last = _refs.size();
+    }
+}
+
+void cc_reference_table::clear(){
+    _postings.clear();
+    _refs.clear();
+    _groups.clear();
+    _present.clear();
+}
+
+size_t cc_reference_table::find(const cc_name_pool& names, const char* s, size_t n) const{
+    size_t id = names.find(s, n);
+    if (!count(id)){
+        return npos;
+    }
+
+    // Groups are ordered by name, search the name
+    name_less less(names);
+    group key(id, 0, 0);
+    vector<group>::const_iterator it = lower_bound(_groups.begin(), _groups.end(), key, less);
+    return (it != _groups.end() && it->id == id) ? it - _groups.begin() : npos;
+}
+
+/// Summary
+///  Move the grouped references back to the postings
+///
+void cc_reference_table::_unseal(){
+    for (size_t g = 0; g < _groups.size(); ++g){
+        for (size_t i = _groups[g].first; i < _groups[g].last; ++i){
+            _postings.push_back(posting(_groups[g].id, _refs[i]));
+        }
     }
+    _groups.clear();
+    _refs.clear();
 }
 
+// BEGIN generated by gen_word_sets.py, do not edit
+static const cc_word keyword_words[] = {
+    { "alignas", 7 }, { "alignof", 7 }, { "and", 3 }, { "and_eq", 6 },
+    { "asm", 3 }, { "auto", 4 }, { "bitand", 6 }, { "bitor", 5 }, { "bool", 4 },
+    { "break", 5 }, { "case", 4 }, { "catch", 5 }, { "char", 4 },
+    { "char16_t", 8 }, { "char32_t", 8 }, { "char8_t", 7 }, { "class", 5 },
+    { "co_await", 8 }, { "co_return", 9 }, { "co_yield", 8 }, { "compl", 5 },
+    { "concept", 7 }, { "const", 5 }, { "const_cast", 10 }, { "consteval", 9 },
+    { "constexpr", 9 }, { "constinit", 9 }, { "continue", 8 },
+    { "decltype", 8 }, { "default", 7 }, { "delete", 6 }, { "do", 2 },
+    { "double", 6 }, { "dynamic_cast", 12 }, { "else", 4 }, { "enum", 4 },
+    { "explicit", 8 }, { "export", 6 }, { "extern", 6 }, { "false", 5 },
+    { "float", 5 }, { "for", 3 }, { "friend", 6 }, { "goto", 4 }, { "if", 2 },
+    { "inline", 6 }, { "int", 3 }, { "long", 4 }, { "mutable", 7 },
+    { "namespace", 9 }, { "new", 3 }, { "noexcept", 8 }, { "not", 3 },
+    { "not_eq", 6 }, { "nullptr", 7 }, { "operator", 8 }, { "or", 2 },
+    { "or_eq", 5 }, { "private", 7 }, { "protected", 9 }, { "public", 6 },
+    { "register", 8 }, { "reinterpret_cast", 16 }, { "requires", 8 },
+    { "return", 6 }, { "short", 5 }, { "signed", 6 }, { "sizeof", 6 },
+    { "static", 6 }, { "static_assert", 13 }, { "static_cast", 11 },
+    { "struct", 6 }, { "switch", 6 }, { "template", 8 }, { "this", 4 },
+    { "thread_local", 12 }, { "throw", 5 }, { "true", 4 }, { "try", 3 },
+    { "typedef", 7 }, { "typeid", 6 }, { "typename", 8 }, { "union", 5 },
+    { "unsigned", 8 }, { "using", 5 }, { "virtual", 7 }, { "void", 4 },
+    { "volatile", 8 }, { "wchar_t", 7 }, { "while", 5 }, { "xor", 3 },
+    { "xor_eq", 6 },
+};
+
+static const unsigned char keyword_slots[512] = {
+    0, 0, 58, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 12, 0, 0, 0, 0, 4, 5, 0, 0, 0, 0, 0, 0, 0, 21,
+    0, 62, 0, 77, 0, 0, 0, 0, 0, 37, 87, 0, 15, 0, 0, 45,
+    0, 0, 57, 0, 88, 0, 0, 0, 0, 0, 0, 0, 44, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 59, 0, 0, 0, 63, 0, 0,
+    64, 0, 0, 0, 0, 0, 0, 0, 0, 0, 18, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 23, 0, 0, 0, 76, 19, 82, 13, 0, 33,
+    68, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 85, 0, 34, 0, 0, 50, 0, 0, 41, 0, 0,
+    0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 43, 0, 0, 0,
+    0, 0, 0, 48, 0, 0, 0, 0, 0, 0, 0, 0, 65, 46, 0, 28,
+    0, 0, 0, 53, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 42, 0, 0, 0, 0, 74, 29, 3, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 31, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 73, 0, 25, 0, 84, 30, 0, 0, 0,
+    0, 0, 0, 0, 0, 35, 0, 0, 0, 0, 0, 52, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 16, 75, 0, 0, 0, 39, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 55, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 51, 0, 0, 0, 0, 83, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 71, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 86, 0, 7, 0, 0, 11, 2, 0, 0,
+    0, 67, 0, 0, 0, 66, 0, 36, 0, 0, 0, 0, 0, 0, 0, 80,
+    0, 0, 91, 0, 81, 61, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 89, 0, 0, 0, 0, 0, 0,
+    0, 0, 9, 0, 0, 0, 0, 0, 10, 40, 0, 0, 0, 0, 0, 47,
+    0, 0, 0, 0, 70, 22, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 24, 0, 0, 20, 0, 0, 0, 0, 69, 72, 0, 0, 0, 0, 0,
+    56, 0, 0, 0, 0, 0, 0, 0, 38, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 54, 0, 27, 0, 0, 0, 0, 0,
+    0, 0, 0, 26, 0, 0, 90, 0, 17, 0, 92, 0, 0, 0, 60, 0,
+    0, 0, 0, 0, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 8, 0, 79, 0, 0, 0, 32, 0, 0, 0, 78, 14,
+};
+
+const cc_word_set cc_symbol_index::_keywords = {
+    keyword_words, 92, keyword_slots, 511, 10829u, 16
+};
+
+static const cc_word class_key_words[] = {
+    { "class", 5 }, { "namespace", 9 }, { "struct", 6 }, { "union", 5 },
+};
+
+static const unsigned char class_key_slots[4] = {
+    1, 3, 2, 4,
+};
+
+const cc_word_set cc_symbol_index::_class_key = {
+    class_key_words, 4, class_key_slots, 3, 5u, 9
+};
+
+static const cc_word base_specifier_words[] = {
+    { "private", 7 }, { "protected", 9 }, { "public", 6 },
+};
+
+static const unsigned char base_specifier_slots[4] = {
+    1, 3, 0, 2,
+};
+
+const cc_word_set cc_symbol_index::_base_specifiers = {
+    base_specifier_words, 3, base_specifier_slots, 3, 1u, 9
+};
+
+static const cc_word access_specifier_words[] = {
+    { "const", 5 },
+};
+
+static const unsigned char access_specifier_slots[4] = {
+    0, 0, 0, 1,
+};
+
+const cc_word_set cc_symbol_index::_access_specifiers = {
+    access_specifier_words, 1, access_specifier_slots, 3, 1u, 5
+};
+// END generated by gen_word_sets.py
+
 ///
 ///  
 ///
-std::pair<char, char> cc_stream::angle_bracket('<', '>');
-std::pair<char, char> cc_stream::round_bracket('(', ')');
-std::pair<char, char> cc_stream::square_bracket('[', ']');
-std::pair<char, char> cc_stream::brace('{', '}');
+const std::pair<char, char> cc_stream::angle_bracket('<', '>');
+const std::pair<char, char> cc_stream::round_bracket('(', ')');
+const std::pair<char, char> cc_stream::square_bracket('[', ']');
+const std::pair<char, char> cc_stream::brace('{', '}');
 
-cc_stream::cc_stream() : _content(0), _length(0), _buff_size(0){}
+cc_stream::cc_stream()
+    : _content(0), _length(0), _buff_size(0), _storage(storage_none), _paired(false){}
 
 cc_stream::cc_stream(const char* fileName)
-    : _content(0), _length(0), _buff_size(0){
+    : _content(0), _length(0), _buff_size(0), _storage(storage_none), _paired(false){
     open(fileName);
 }
 
 cc_stream::cc_stream(const cc_stream& rval)
-    : _content(0), _length(rval._length), _buff_size(rval._buff_size) {
+    : _content(0), _length(rval._length), _buff_size(rval._length + 2),
+      _storage(storage_none), _erased(rval._erased), _lines(rval._lines),
+      _paired(rval._paired) {
+    for (int t = 0; t < pair_type_count; ++t) {
+        _pairs[t] = rval._pairs[t];
+    }
     if (_length) {
-        _content = new char[_length];
-        memcpy(_content, rval._content, _length);
+        char* buff = new char[_buff_size];
+        memcpy(buff, rval._content, _length);
+        buff[_length] = buff[_length + 1] = 0;
+
+        _content = buff;
+        _storage = storage_heap;
     }
 }
 
@@ -112,53 +728,198 @@ cc_stream::~cc_stream(){
 bool cc_stream::open(const char* fileName){
     if (_content){ return false; }
 
+#ifndef _WIN32
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    bool mapped = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && _map(fd, static_cast<size_t>(st.st_size));
+    ::close(fd);
+
+    if (mapped) {
+        return true;
+    }
+#endif
+
     ifstream fs(fileName, ios::in | ios::binary);
     if (!fs.is_open() || fs.fail()) {
         return false;
     }
 
     fs.seekg(0, ios::end);
-    _length = static_cast<size_t>(fs.tellg());
+    streamoff size = fs.tellg();
+    if (size < 0) {
+        // not seekable, such as a pipe, read until the end
+        fs.clear();
+        std::string data;
+        char chunk[64 * 1024];
+        while (fs.read(chunk, sizeof(chunk)) || fs.gcount() > 0) {
+            data.append(chunk, static_cast<size_t>(fs.gcount()));
+        }
+        return !fs.bad() && assign(data.data(), data.size());
+    }
+
+    _length = static_cast<size_t>(size);
     _buff_size = _length + 2;
     fs.seekg(0, ios::beg);
 
-    _content = new char[_buff_size];
-    fs.read(_content, _length);
+    char* buff = new char[_buff_size];
+    fs.read(buff, _length);
+    _length = static_cast<size_t>(fs.gcount());
+    _adopt(buff);
+    return true;
+}
+
+bool cc_stream::assign(const char* data, size_t size){
+    if (_content){ return false; }
+
+    _length = size;
+    _buff_size = _length + 2;
 
+    char* buff = new char[_buff_size];
+    memcpy(buff, data, _length);
+    _adopt(buff);
+    return true;
+}
+
+/// Summary
+///  Take the heap buffer <buff> holding _length bytes as the content
+///
+void cc_stream::_adopt(char* buff){
     //  Several additional characters are appended to the buffer so that we can
     // process the file without considering different file endings
     //
-    if (_content[_length - 1] != '\n') {
-        _content[_length++] = '\n';
+    if (!_length || buff[_length - 1] != '\n') {
+        buff[_length++] = '\n';
     }
-    _content[_length] = _content[_buff_size - 1] = 0;
+    buff[_length] = buff[_buff_size - 1] = 0;
+
+    _content = buff;
+    _storage = storage_heap;
+    _index_lines();
+}
+
+/// Summary
+///  Record where each line begins, the content ends with a LF
+///
+void cc_stream::_index_lines(){
+    _lines.assign(1, 0);
+    line_starts(_content, 0, _length - 1, _lines);
+}
+
+/// Summary
+///  Map <size> bytes of file <fd> into memory read-only
+///
+bool cc_stream::_map(int fd, size_t size){
+#ifndef _WIN32
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t buff_size = (size + 2 + page - 1) / page * page;
+
+    //  Reserve the buffer with anonymous zero pages first and map the file over
+    // the head of it, so that there is room for the LF and terminators that
+    // open appends even if the file size is a multiple of the page size
+    //
+    void* base = mmap(0, buff_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    if (mmap(base, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, buff_size);
+        return false;
+    }
+
+    // Only the last page is copied if the LF has to be appended
+    char* buff = static_cast<char*>(base);
+    if (buff[size - 1] != '\n') {
+        buff[size++] = '\n';
+    }
+    mprotect(base, buff_size, PROT_READ);
+
+    _content = buff;
+    _length = size;
+    _buff_size = buff_size;
+    _storage = storage_mapped;
+    _index_lines();
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool cc_stream::attach(const cc_stream& base){
+    if (_content || !base._content){ return false; }
+
+    _content = base._content;
+    _length = base._length;
+    _buff_size = base._buff_size;
+    _storage = storage_shared;
+    _lines = base._lines;
     return true;
 }
 
 bool cc_stream::close() {
-    delete[] _content;
+    switch (_storage) {
+    case storage_heap:
+        delete[] _content;
+        break;
+    case storage_mapped:
+#ifndef _WIN32
+        munmap(const_cast<char*>(_content), _buff_size);
+#endif
+        break;
+    default:
+        break;
+    }
+
     _content = 0;
     _buff_size = _length = 0;
+    _storage = storage_none;
+    std::vector<uint64_t>().swap(_erased);
+    std::vector<size_t>().swap(_lines);
+    for (int t = 0; t < pair_type_count; ++t){
+        std::vector<cc_reference>().swap(_pairs[t]);
+    }
+    _paired = false;
+    return true;
+}
+
+bool cc_stream::getline(cc_reference& line) const{
+    if (line.end >= _length){
+        return false;
+    }
+
+    line.begin = line.end;
+    line.end = line_end(line_of(line.begin));
     return true;
 }
 
+size_t cc_stream::line_of(size_t p) const{
+    return std::upper_bound(_lines.begin(), _lines.end(), p) - _lines.begin() - 1;
+}
+
 bool cc_stream::read_name(size_t& p, std::string& name) const {
     size_t i;
     size_t beg = -1, end = -1;
 
     for (i = p; i < _length; ++i) {
-        if (is_identifier(_content[i])) {
+        if (is_identifier(at(i))) {
             beg = i;
             end = i + 1;
             break;
         }
-        else if (!is_whitespace(_content[i])) {
+        else if (!is_whitespace(at(i))) {
             return false;
         }
     }
 
     for (; i < _length; ++i) {
-        if (is_separator(_content[i])) {
+        if (is_separator(at(i))) {
             end = i;
             break;
         }
@@ -172,7 +933,7 @@ bool cc_stream::read_name(size_t& p, std::string& name) const {
     return name.length() != 0;
 }
 
-bool cc_stream::read_complete_name(size_t& p, string_vect& sv) const{
+bool cc_stream::read_complete_name(size_t& p, cc_scope_vect& sv) const{
     size_t original_size = sv.size();
 
     size_t dfa_state = 0;
@@ -182,60 +943,60 @@ bool cc_stream::read_complete_name(size_t& p, string_vect& sv) const{
     for (size_t i = p; i < _length; ++i) {
         switch (dfa_state) {
         case 0:
-            if (is_identifier(_content[i])){
+            if (is_identifier(at(i))){
                 beg = i;
                 dfa_state = 1;
             }
-            else if (_content[i] == ':') {
+            else if (at(i) == ':') {
                 dfa_state = 2;
             }
-            else if (!is_whitespace(_content[i])){
+            else if (!is_whitespace(at(i))){
                 dfa_state = -1;
             }
             break;
         case 1:
-            if (is_separator(_content[i])) {
+            if (is_separator(at(i))) {
                 end = i;
                 p = end - 1;
                 name.assign(_content + beg, end - beg);
                 sv.push_back(name);
 
-                if (is_whitespace(_content[i])){
+                if (is_whitespace(at(i))){
                     dfa_state = 5;
                 }
-                else if (_content[i] == ':'){
+                else if (at(i) == ':'){
                     dfa_state = 2;
                 }
                 else { dfa_state = -1; };
             }
             break;
         case 2:
-            dfa_state = (_content[i] == ':') ? 3 : -1;
+            dfa_state = (at(i) == ':') ? 3 : -1;
             break;
         case 3:
-            if (is_identifier(_content[i])){
+            if (is_identifier(at(i))){
                 beg = i;
                 dfa_state = 1;
             }
-            else if (is_whitespace(_content[i])){
+            else if (is_whitespace(at(i))){
                 dfa_state = 4;
             }
             else { dfa_state = -1; }
             break;
         case 4:
-            if (is_identifier(_content[i])){
+            if (is_identifier(at(i))){
                 beg = i;
                 dfa_state = 1;
             }
-            else if (!is_whitespace(_content[i])){
+            else if (!is_whitespace(at(i))){
                 dfa_state = -1;
             }
             break;
         case 5:
-            if (_content[i] == ':'){
+            if (at(i) == ':'){
                 dfa_state = 2;
             }
-            else if (!is_whitespace(_content[i])){
+            else if (!is_whitespace(at(i))){
                 dfa_state = -1;
             }
             break;
@@ -246,7 +1007,7 @@ bool cc_stream::read_complete_name(size_t& p, string_vect& sv) const{
     return sv.size() != original_size;
 }
 
-bool cc_stream::parse_identifier(cc_name_def_list& id_list, size_t begin, size_t end) const {
+bool cc_stream::parse_identifier(cc_token_list& tokens, size_t begin, size_t end) const {
     if (end > _length) {
         end = _length;
     }
@@ -257,14 +1018,14 @@ bool cc_stream::parse_identifier(cc_name_def_list& id_list, size_t begin, size_t
 
     cc_reference id_ref;
     for (size_t i = begin; i < end; ++i){
-        for (; i < end && !is_identifier(_content[i]); ++i);
+        for (; i < end && !is_identifier(at(i)); ++i);
         id_ref.begin = i;
 
-        for (; i < end && !is_separator(_content[i]); ++i);
+        for (; i < end && !is_separator(at(i)); ++i);
         id_ref.end = i;
 
         if (id_ref.end > id_ref.begin){
-            id_list.push_back(cc_name_def(*this, id_ref));
+            tokens.push_back(cc_token(id_ref.begin, id_ref.end));
         }
     }
     return true;
@@ -274,14 +1035,40 @@ size_t cc_stream::erase(size_t beg, size_t end){
     if (end > _length){
         end = _length;
     }
+    if (end <= beg){
+        return 0;
+    }
 
-    size_t i;
-    for (i = beg; i < end; ++i){
-        if (_content[i] != '\n'){
-            _content[i] = ' ';
+    if (_erased.empty()){
+        _erased.resize((_length + 2 + 63) / 64);
+    }
+    _paired = false;
+
+    size_t i = beg;
+    for (; i < end && i % 64; ++i){
+        _erased[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    for (; i + 64 <= end; i += 64){
+        _erased[i / 64] = ~uint64_t(0);
+    }
+    for (; i < end; ++i){
+        _erased[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    return end - beg;
+}
+
+size_t cc_stream::skip_erased(size_t p) const{
+    while (p < _length && is_erased(p)){
+        if (p % 64 == 0 && _erased[p / 64] == ~uint64_t(0)){
+            p += 64;
         }
+        else { ++p; }
     }
-    return i - beg;
+    return p < _length ? p : _length;
+}
+
+static bool pair_before(const cc_reference& l, const cc_reference& r){
+    return l.begin < r.begin;
 }
 
 bool cc_stream::find_pair(
@@ -291,7 +1078,7 @@ bool cc_stream::find_pair(
 
     int depth = 0;
     for (size_t i = begin; i < end; ++i){
-        if (_content[i] == ptype.first){
+        if (at(i) == ptype.first){
             ++depth;
             pref.begin = pref.end = i;
             break;
@@ -300,11 +1087,23 @@ bool cc_stream::find_pair(
 
     if (!depth){ return false; }
 
+    int type = _pair_type(ptype);
+    if (_paired && type >= 0){
+        vector<cc_reference>::const_iterator it = lower_bound(
+            _pairs[type].begin(), _pairs[type].end(), pref, pair_before);
+        if (it != _pairs[type].end() && it->begin == pref.begin
+            && it->end != 0 && it->end <= end){
+            pref.end = it->end;
+            return true;
+        }
+        return false;
+    }
+
     for (size_t i = pref.begin + 1; i < end; ++i){
-        if (_content[i] == ptype.first){
+        if (at(i) == ptype.first){
             ++depth;
         }
-        else if (_content[i] == ptype.second){
+        else if (at(i) == ptype.second){
             if (--depth == 0){
                 pref.end = i + 1;
                 return true;
@@ -314,6 +1113,59 @@ bool cc_stream::find_pair(
     return false;
 }
 
+void cc_stream::index_pairs(){
+    vector<size_t> open[pair_type_count];
+    for (int t = 0; t < pair_type_count; ++t){
+        _pairs[t].clear();
+    }
+
+    for (size_t i = 0; i < _length; ++i){
+        i = char_class.skip(_content, i, _length, ccf_bracket);
+        if (i >= _length){
+            break;
+        }
+        if (is_erased(i)){
+            continue;
+        }
+
+        int t;
+        bool opening = true;
+        switch (_content[i]){
+        case '{': t = 0; break;
+        case '(': t = 1; break;
+        case '[': t = 2; break;
+        case '<': t = 3; break;
+        case '}': t = 0; opening = false; break;
+        case ')': t = 1; opening = false; break;
+        case ']': t = 2; opening = false; break;
+        default:  t = 3; opening = false; break;
+        }
+
+        // An opening bracket is recorded unmatched until its closing one is
+        //found, closing brackets without an opening one are ignored
+        if (opening){
+            open[t].push_back(_pairs[t].size());
+            _pairs[t].push_back(cc_reference(i, 0));
+        }
+        else if (!open[t].empty()){
+            _pairs[t][open[t].back()].end = i + 1;
+            open[t].pop_back();
+        }
+    }
+    _paired = true;
+}
+
+/// Summary
+///  Index of <ptype> in the pair table, or -1 if it is not a predefined type
+///
+int cc_stream::_pair_type(const std::pair<char, char>& ptype){
+    if (ptype == brace){ return 0; }
+    if (ptype == round_bracket){ return 1; }
+    if (ptype == square_bracket){ return 2; }
+    if (ptype == angle_bracket){ return 3; }
+    return -1;
+}
+
 ///
 ///
 ///
@@ -322,133 +1174,561 @@ bool cc_symbol_base::add_file(const string& srcfile){
         return false;
     }
 
+    // A file of the database keeps its stored index
+    if (!_symbol_map.count(srcfile) && _is_stored(srcfile)){
+        return true;
+    }
+
     _symbol_map[srcfile];
     return true;
 }
 
 bool cc_symbol_base::remove_file(const string& srcfile){
-    return _symbol_map.erase(srcfile) != 0;
+    bool stored = _is_stored(srcfile);
+    if (stored){
+        _dropped.insert(srcfile);
+    }
+    return _symbol_map.erase(srcfile) != 0 || stored;
 }
 
 bool cc_symbol_base::reparse_file(const string& srcfile){
     cc_stream ccs;
-    cc_symbol_map::iterator it = _symbol_map.find(srcfile);
-    if (it == _symbol_map.end() || !ccs.open(srcfile.data())){
+    if ((!_symbol_map.count(srcfile) && !_is_stored(srcfile)) || !ccs.open(srcfile.data())){
         return false;
     }
 
     bool result;
-    it->second.clear();
-    result = it->second.parse_stream(ccs);
+    cc_symbol_entry& entry = _symbol_map[srcfile];
+    entry.index.clear();
+    result = entry.index.parse_stream(ccs);
+    if (!_stamp_file(srcfile, ccs, entry.stamp)){
+        entry.stamp = cc_file_stamp();
+    }
     ccs.close();
     return result;
 }
 
-bool cc_symbol_base::build(){
+/// Summary
+///  Hands the files of a build out to the workers
+///
+///  Files are dealt to the queues of the workers largest first. A worker
+/// takes the largest file left in its own queue, when the queue runs dry it
+/// steals the smallest file left in the queue of another worker.
+///
+class build_scheduler {
+public:
+    build_scheduler(const vector<size_t>& order, size_t workers)
+        : _queues(workers) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            _queues[i % workers].items.push_back(order[i]);
+        }
+    }
+
+    /// Take the next file for <worker>, returns false when there is none
+    bool take(size_t worker, size_t& item) {
+        for (size_t k = 0; k < _queues.size(); ++k) {
+            file_queue& q = _queues[(worker + k) % _queues.size()];
+            lock_guard<mutex> guard(q.lock);
+            if (q.items.empty()) {
+                continue;
+            }
+
+            if (k == 0) {
+                item = q.items.front();
+                q.items.pop_front();
+            }
+            else {
+                item = q.items.back();
+                q.items.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct file_queue {
+        std::mutex          lock;
+        std::deque<size_t>  items;
+    };
+
+    vector<file_queue>  _queues;
+};
+
+/// Summary
+///  Files of a build and the state the workers share
+///
+///  <entry> of a stored file that is not decoded is 0, the file only gets
+/// an entry in _symbol_map if it has to be parsed. Workers insert these
+/// entries under <map_mutex>, inserting into a std::map does not move the
+/// entries other workers are parsing into.
+///
+class cc_symbol_base::_build_state {
+public:
+    struct item {
+        string              path;
+        cc_symbol_entry*    entry;
+        cc_file_stamp       stamp;  // stamp of a stored file
+        uint64_t            size;
+        file_state          state;
+    };
+
+    struct larger {
+        explicit larger(const vector<item>& i): items(i) {}
+
+        bool operator()(size_t l, size_t r) const {
+            return items[l].size > items[r].size;
+        }
+
+        const vector<item>& items;
+    };
+
+    vector<item>        items;
+    build_scheduler*    scheduler;
+    std::mutex          map_mutex;
+};
+
+bool cc_symbol_base::build(size_t jobs){
+    _last_failed.clear();
+    _last_skipped.clear();
+
+    _build_state state;
+    _build_state::item item;
+    item.state = file_unchanged;
+
     cc_symbol_map::iterator it = _symbol_map.begin();
     cc_symbol_map::iterator end = _symbol_map.end();
-
-    cc_stream ccs;
     for (; it != end; ++it){
-        if (!ccs.open(it->first.data())){
-            _last_failed.push_back(it->first);
+        item.path = it->first;
+        item.entry = &it->second;
+        item.size = it->second.stamp.size;
+        state.items.push_back(item);
+    }
+
+    // Stored files stay in the database unless they have to be parsed
+    for (size_t s = 0; s < _db_files; ++s){
+        stored_file f = _stored(s);
+        item.path.assign(f.path, f.path_length);
+        if (_symbol_map.count(item.path) || _dropped.count(item.path)){
+            continue;
         }
-        it->second.parse_stream(ccs);
-        ccs.close();
+        item.entry = 0;
+        item.stamp = _stored_stamp(item.path, f);
+        item.size = item.stamp.size;
+        state.items.push_back(item);
+    }
+
+    // Sizes of files that were never stamped are only needed for the order
+    vector<size_t> order(state.items.size());
+    for (size_t i = 0; i < order.size(); ++i){
+        struct stat st;
+        if (state.items[i].size == 0 && stat(state.items[i].path.c_str(), &st) == 0){
+            state.items[i].size = uint64_t(st.st_size);
+        }
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), _build_state::larger(state.items));
+
+    if (jobs == 0){
+        jobs = thread::hardware_concurrency();
+    }
+    if (jobs > order.size()){
+        jobs = order.size();
     }
+
+    if (jobs <= 1){
+        cc_stream ccs;
+        for (size_t i = 0; i < order.size(); ++i){
+            _build_file(state, order[i], ccs);
+        }
+    }
+    else{
+        build_scheduler scheduler(order, jobs);
+        state.scheduler = &scheduler;
+
+        vector<thread> workers;
+        for (size_t i = 0; i < jobs; ++i){
+            workers.push_back(thread(&cc_symbol_base::_build_worker, this, &state, i));
+        }
+        for (size_t i = 0; i < workers.size(); ++i){
+            workers[i].join();
+        }
+    }
+
+    for (size_t i = 0; i < state.items.size(); ++i){
+        const _build_state::item& bi = state.items[i];
+        switch (bi.state){
+        case file_touched:
+            if (!bi.entry){
+                _restamped[bi.path] = bi.stamp;
+            }
+            // fall through
+        case file_unchanged:
+            _last_skipped.push_back(bi.path);
+            break;
+        case file_failed:
+            _last_failed.push_back(bi.path);
+            break;
+        default:
+            break;
+        }
+    }
+    sort(_last_skipped.begin(), _last_skipped.end());
+    sort(_last_failed.begin(), _last_failed.end());
     return _last_failed.size() == 0;
 }
 
+void cc_symbol_base::_build_worker(_build_state* state, size_t worker){
+    cc_stream ccs;
+    size_t item;
+    while (state->scheduler->take(worker, item)){
+        _build_file(*state, item, ccs);
+    }
+}
+
+void cc_symbol_base::_build_file(_build_state& state, size_t i, cc_stream& ccs){
+    _build_state::item& item = state.items[i];
+    cc_file_stamp& stamp = item.entry ? item.entry->stamp : item.stamp;
+    item.state = _check_file(item.path, stamp, ccs);
+
+    if (item.state == file_changed || item.state == file_failed){
+        if (!item.entry){
+            lock_guard<mutex> lock(state.map_mutex);
+            item.entry = &_symbol_map[item.path];
+        }
+        item.entry->stamp = item.state == file_changed ? stamp : cc_file_stamp();
+
+        if (item.state == file_changed){
+            item.entry->index.parse_stream(ccs);
+        }
+        else{
+            item.entry->index.clear();
+        }
+    }
+    ccs.close();
+}
+
 bool cc_symbol_base::clean(){
+    _unstore();
+
     cc_symbol_map::iterator it = _symbol_map.begin();
     cc_symbol_map::iterator end = _symbol_map.end();
 
     for (; it != end; ++it){
-        it->second.clear();
+        it->second.index.clear();
+        it->second.stamp = cc_file_stamp();
     }
     _last_failed.clear();
+    _last_skipped.clear();
     return true;
 }
 
-void cc_symbol_base::drop(){
-    _symbol_map.clear();
-    _last_failed.clear();
-}
+uint64_t cc_file_stamp::content_hash(const char* s, size_t n, uint64_t seed){
+    const uint64_t m = 0x9e3779b97f4a7c15ull;
+    uint64_t h = seed ^ (n * m);
+    uint64_t w;
 
-bool cc_symbol_base::save_data(const char* dbfile) const{
-    // not implemented yet
-    return false;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        memcpy(&w, s + i, 8);
+        h = (h ^ w) * m;
+        h ^= h >> 29;
+    }
+
+    w = 0;
+    memcpy(&w, s + i, n - i);
+    h = (h ^ w) * m;
+    return h ^ (h >> 32);
 }
 
-bool cc_symbol_base::load_data(const char* dbfile){
-    // not implemented yet
-    return false;
+/// Summary
+///  Compare <srcfile> with <stamp>
+///
+///  The content is only read if the size or the modification time differs,
+/// <ccs> is left open then and <stamp> is updated. The caller parses <ccs> if
+/// the file changed.
+///
+cc_symbol_base::file_state cc_symbol_base::_check_file(
+    const string& srcfile, cc_file_stamp& stamp, cc_stream& ccs){
+    struct stat st;
+    if (stat(srcfile.c_str(), &st) != 0){
+        return file_failed;
+    }
+
+    if (stamp.mtime != 0 && stamp.mtime == int64_t(st.st_mtime)
+        && stamp.size == uint64_t(st.st_size)){
+        return file_unchanged;
+    }
+
+    cc_file_stamp current;
+    if (!ccs.open(srcfile.c_str()) || !_stamp_file(srcfile, ccs, current)){
+        return file_failed;
+    }
+
+    bool same_content = current.size == stamp.size && current.hash == stamp.hash
+        && stamp.size != 0;
+    stamp = current;
+    return same_content ? file_touched : file_changed;
 }
 
-const cc_symbol_index* cc_symbol_base::find_index(const string& srcfile) const{
-    cc_symbol_map::const_iterator it = _symbol_map.find(srcfile);
-    if (it != _symbol_map.end()){
-        return &(it->second);
+/// Summary
+///  Stamp <srcfile> with the content of <ccs>, which has to be opened from it
+///
+bool cc_symbol_base::_stamp_file(const string& srcfile, const cc_stream& ccs,
+                                 cc_file_stamp& stamp){
+    struct stat st;
+    if (stat(srcfile.c_str(), &st) != 0){
+        return false;
     }
-    return 0;
+
+    stamp.size = uint64_t(st.st_size);
+    stamp.mtime = int64_t(st.st_mtime);
+    stamp.hash = cc_file_stamp::content_hash(ccs.content(), ccs.length());
+
+    // A file modified within the second it is stamped may still change
+    //without the modification time telling, so its content is checked again
+    //by the next build
+    //
+    if (stamp.mtime >= int64_t(time(0))){
+        stamp.mtime = 0;
+    }
+    return true;
+}
+
+void cc_symbol_base::drop(){
+    _symbol_map.clear();
+    _last_failed.clear();
+
+    _db.close();
+    _db_files = 0;
+    _dropped.clear();
+    _restamped.clear();
 }
 
 ///
 ///
 ///
-cc_keyword_set   cc_symbol_index::_keywords;
-cc_class_key_set cc_symbol_index::_class_key;
-cc_base_specifier_set cc_symbol_index::_base_specifiers;
-cc_access_specifier_set cc_symbol_index::_access_specifiers;
-
-bool cc_symbol_index::parse_stream(const cc_stream& ccs){
-    clear();
-    cc_stream scontext(ccs);
 
-    // Comments, strings, characters and preprocessors should
-    //be processed first
+/// Summary
+///  Single pass lexer for comments, strings, characters, preprocessor lines,
+/// identifiers and method references
+///
+///  Every token type is still recognized by its own DFA, and each DFA reads
+/// the stream with the tokens of the DFAs before it already erased, just like
+/// the standalone passes did. Instead of walking the whole stream once per
+/// DFA, the DFAs are chained as a pipeline over a small window: a stage only
+/// consumes bytes that all of its upstream stages have settled, that is bytes
+/// which are not part of a token that is still being recognized.
+///
+class cc_symbol_index::_fused_lexer {
+public:
+    typedef cc_lex_checkpoint checkpoint;
+
+    _fused_lexer(cc_symbol_index& index, const cc_stream& ccs,
+                 cc_stream& scontext, cc_token_list& tokens);
+
+    /// Summary
+    ///  Lex the whole stream, the state of every stage is taken where each
+    /// of <checkpoints> begins. Checkpoints some stage could not stop at are
+    /// removed.
+    ///
+    void run(cc_lex_checkpoint_list& checkpoints);
+
+    /// Summary
+    ///  Lex from <cp>, or from the beginning if it is 0, until the tokens
+    /// that begin before <end> are complete
+    ///
+    void resume(const cc_lex_checkpoint* cp, size_t end);
+
+private:
+    struct dfa {
+        dfa(size_t s = 0)
+            : state(s), back_state(0), begin(-1), end(-1), pos(0) {}
+
+        size_t state;
+        size_t back_state;  // state to return to after an escape
+        size_t begin;       // beginning of the token being recognized
+        size_t end;
+        size_t pos;         // next byte to consume
+    };
+
+    // Each _lex_xxx method consumes bytes up to <limit> and returns the
+    //position before which the stream will no longer be erased by the stage
     //
-    _lex_comment(scontext);
-    _lex_string(scontext);
-    _lex_character(scontext);
-    _lex_preprocessor(scontext);
+    size_t _lex_comment(size_t limit);
+    size_t _lex_string(size_t limit);
+    size_t _lex_character(size_t limit);
+    size_t _lex_preprocessor(size_t limit);
+    void   _lex_identifier(size_t limit);
+    void   _lex_method(size_t limit);
+
+    size_t _settled(const dfa& d, bool pending, size_t limit) const {
+        size_t p = d.pos >= _length ? _length : (pending ? d.begin : d.pos);
+        return p < limit ? p : limit;
+    }
 
-    cc_name_def_list id_list;
-    scontext.parse_identifier(id_list);
+    bool _name_settled(size_t p, size_t limit) const;
+    size_t _skip(size_t p, size_t end, unsigned char mask) const;
+
+    void   _step(size_t limit);
+    size_t _run_stage(int stage, size_t limit);
+    size_t _lex_stage(int stage, size_t limit);
+
+private:
+    static const size_t window_size = 16 * 1024;
+
+    cc_symbol_index&    _index;
+    size_t              _window;    // window_size, or the stream in multi-pass
+    cc_stream&          _scontext;
+    cc_token_list&      _tokens;
+    const char*         _data;      // original content
+    size_t              _length;
+
+    dfa _comment;
+    dfa _string;
+    dfa _character;
+    dfa _preprocessor;
+    dfa _identifier;
+    dfa _method;
+    dfa* _stages[checkpoint::stage_count];
+
+    // Checkpoints being taken, and the next one of each stage
+    cc_lex_checkpoint_list* _checkpoints;
+    size_t _next_checkpoint[checkpoint::stage_count];
+};
 
-    // _resolve_xxx_ref methods will remove those identifiers that have been
-    //resolved from the list, thus the calling order implies the priority of 
-    //each type resolution.
-    //
-    _resolve_macro_ref(id_list);
-    _resolve_keyword_ref(id_list);
+cc_symbol_index::_fused_lexer::_fused_lexer(cc_symbol_index& index,
+    const cc_stream& ccs, cc_stream& scontext, cc_token_list& tokens)
+    : _index(index), _scontext(scontext), _tokens(tokens),
+      _data(ccs.content()),
+      _length(scontext.length()), _preprocessor(1), _checkpoints(0) {
+    // A window as large as the stream has every stage walk the whole stream
+    //before the next one starts
+    _window = index._multi_pass && _length > window_size ? _length : window_size;
+    _stages[checkpoint::stage_comment] = &_comment;
+    _stages[checkpoint::stage_string] = &_string;
+    _stages[checkpoint::stage_character] = &_character;
+    _stages[checkpoint::stage_preprocessor] = &_preprocessor;
+    _stages[checkpoint::stage_identifier] = &_identifier;
+    _stages[checkpoint::stage_method] = &_method;
+}
 
-    // Handle type definitions
-    _lex_enumeration(scontext);
-    _lex_class(scontext);
+void cc_symbol_index::_fused_lexer::run(cc_lex_checkpoint_list& checkpoints){
+    _checkpoints = &checkpoints;
+    for (int s = 0; s < checkpoint::stage_count; ++s){
+        _next_checkpoint[s] = 0;
+    }
 
-    // Resolve user type references
-    _resolve_class_ref(id_list);
-    _resolve_enum_ref(id_list);
-    _resolve_constant_ref(id_list); // enum constant
-    _resolve_external_type_ref(scontext, id_list);
-    _resolve_external_scope_ref(scontext, id_list);
+    for (size_t limit = 0; limit < _length;){
+        limit = min(limit + _window, _length);
+        _step(limit);
+    }
+    for (int s = 0; s < checkpoint::stage_count; ++s){
+        _run_stage(s, _length);
+    }
+    _checkpoints = 0;
+
+    // Checkpoints some stage stopped short of or ran past were marked, the
+    //preprocessor waits for directive names and escapes skip a CR
+    size_t n = 0;
+    for (size_t i = 0; i < checkpoints.size(); ++i){
+        if (checkpoints[i].line != size_t(-1)){
+            checkpoints[n++] = checkpoints[i];
+        }
+    }
+    checkpoints.resize(n);
+}
 
-    _lex_method(ccs);
-    for (cc_keyword_set::iterator it = _keywords.begin(),
-         end = _keywords.end(); it != end; ++it){
-        _method_ref_map.erase(*it);
+void cc_symbol_index::_fused_lexer::resume(const cc_lex_checkpoint* cp, size_t end){
+    size_t limit = 0;
+    if (cp){
+        for (int s = 0; s < checkpoint::stage_count; ++s){
+            dfa& d = *_stages[s];
+            d.state = cp->stages[s].state;
+            d.back_state = cp->stages[s].back_state;
+            d.begin = cp->stages[s].begin;
+            d.end = cp->stages[s].end;
+            d.pos = cp->pos;
+        }
+        limit = cp->pos;
+    }
+
+    // The identifier stage comes last, once it is through <end> so are the
+    //stages before it
+    while (limit < _length
+           && (_identifier.pos < end || _identifier.state != 0
+               || _method.pos < end || _method.state != 0)){
+        limit = min(limit + _window, _length);
+        _step(limit);
     }
-    return true;
 }
 
-void cc_symbol_index::_lex_comment(cc_stream& scontext){
-    size_t dfa_state = 0;
-    size_t dfa_escape_back_state = 0;
-    size_t begin = -1;
+void cc_symbol_index::_fused_lexer::_step(size_t limit){
+    _run_stage(checkpoint::stage_method, limit);
+
+    size_t settled = _run_stage(checkpoint::stage_comment, limit);
+    settled = _run_stage(checkpoint::stage_string, settled);
+    settled = _run_stage(checkpoint::stage_character, settled);
+    settled = _run_stage(checkpoint::stage_preprocessor, settled);
+    _run_stage(checkpoint::stage_identifier, settled);
+}
 
-    for (size_t i = 0; i < scontext.length(); ++i){
-        char input_ch = scontext.content()[i];
+/// Summary
+///  Run <stage> up to <limit>, stopping at each checkpoint on the way to take
+/// its state
+///
+size_t cc_symbol_index::_fused_lexer::_run_stage(int stage, size_t limit){
+    if (_checkpoints){
+        size_t& next = _next_checkpoint[stage];
+        for (; next < _checkpoints->size() && (*_checkpoints)[next].pos <= limit; ++next){
+            cc_lex_checkpoint& cp = (*_checkpoints)[next];
+            _lex_stage(stage, cp.pos);
+
+            const dfa& d = *_stages[stage];
+            if (d.pos != cp.pos){
+                cp.line = -1;
+            }
+            cp.stages[stage].state = (unsigned char)d.state;
+            cp.stages[stage].back_state = (unsigned char)d.back_state;
+            cp.stages[stage].begin = d.begin;
+            cp.stages[stage].end = d.end;
+        }
+    }
+    return _lex_stage(stage, limit);
+}
+
+size_t cc_symbol_index::_fused_lexer::_lex_stage(int stage, size_t limit){
+    switch (stage){
+    case checkpoint::stage_comment: return _lex_comment(limit);
+    case checkpoint::stage_string: return _lex_string(limit);
+    case checkpoint::stage_character: return _lex_character(limit);
+    case checkpoint::stage_preprocessor: return _lex_preprocessor(limit);
+    case checkpoint::stage_identifier: _lex_identifier(limit); break;
+    case checkpoint::stage_method: _lex_method(limit); break;
+    }
+    return limit;
+}
+
+size_t cc_symbol_index::_fused_lexer::_lex_comment(size_t limit){
+    size_t dfa_state = _comment.state;
+    size_t dfa_escape_back_state = _comment.back_state;
+    size_t begin = _comment.begin;
+    size_t i = _comment.pos;
+
+    for (; i < limit; ++i){
+        // skip to the next byte the state reacts to
+        switch (dfa_state){
+        case 0: i = char_class.skip(_data, i, limit, ccf_comment); break;
+        case 2: i = char_class.skip(_data, i, limit, ccf_preprocessor); break;
+        case 20: i = char_class.skip(_data, i, limit, ccf_string); break;
+        case 3: {
+            const char* star = static_cast<const char*>(memchr(_data + i, '*', limit - i));
+            i = star ? star - _data : limit;
+            break;
+        }
+        }
+        if (i >= limit){ break; }
+        char input_ch = _data[i];
 
         switch (dfa_state){
         case 0:
@@ -477,7 +1757,7 @@ void cc_symbol_index::_lex_comment(cc_stream& scontext){
             switch (input_ch){
             case '\n':
                 dfa_state = 0;
-                _add_comment_def(scontext, begin, i);
+                _index._add_comment_def(_scontext, begin, i);
                 break;
             case '\\':
                 dfa_escape_back_state = dfa_state;
@@ -493,7 +1773,7 @@ void cc_symbol_index::_lex_comment(cc_stream& scontext){
         case 4:
             if (input_ch == '/'){
                 dfa_state = 0;
-                _add_comment_def(scontext, begin, i + 1);
+                _index._add_comment_def(_scontext, begin, i + 1);
             }
             else if (input_ch != '*'){
                 dfa_state = 3;
@@ -519,15 +1799,29 @@ void cc_symbol_index::_lex_comment(cc_stream& scontext){
             break;
         }
     }
+
+    _comment.state = dfa_state;
+    _comment.back_state = dfa_escape_back_state;
+    _comment.begin = begin;
+    _comment.pos = i;
+
+    bool pending = (dfa_state >= 1 && dfa_state <= 4)
+        || (dfa_state == 10 && dfa_escape_back_state == 2);
+    return _settled(_comment, pending, limit);
 }
 
-void cc_symbol_index::_lex_string(cc_stream& scontext){
-    size_t dfa_state = 0;
-    size_t dfa_escape_back_state = 0;
-    size_t begin = -1;
+size_t cc_symbol_index::_fused_lexer::_lex_string(size_t limit){
+    size_t dfa_state = _string.state;
+    size_t dfa_escape_back_state = _string.back_state;
+    size_t begin = _string.begin;
+    size_t i = _string.pos;
 
-    for (size_t i = 0; i < scontext.length(); ++i){
-        char input_ch = scontext.content()[i];
+    for (; i < limit; ++i){
+        if (dfa_state != 10){
+            i = _skip(i, limit, ccf_string);
+            if (i >= limit){ break; }
+        }
+        char input_ch = _scontext.at(i);
 
         switch (dfa_state){
         case 0:
@@ -543,7 +1837,7 @@ void cc_symbol_index::_lex_string(cc_stream& scontext){
         case 1:
             if (input_ch == '\"'){
                 dfa_state = 0;
-                _add_string_def(scontext, begin, i + 1);
+                _index._add_string_def(_scontext, begin, i + 1);
                 begin = -1;
             }
             else if (input_ch == '\\'){
@@ -559,14 +1853,27 @@ void cc_symbol_index::_lex_string(cc_stream& scontext){
             break;
         }
     }
+
+    _string.state = dfa_state;
+    _string.back_state = dfa_escape_back_state;
+    _string.begin = begin;
+    _string.pos = i;
+
+    bool pending = dfa_state == 1 || (dfa_state == 10 && dfa_escape_back_state == 1);
+    return _settled(_string, pending, limit);
 }
 
-void cc_symbol_index::_lex_character(cc_stream& scontext){
-    size_t dfa_state = 0;
-    size_t begin = 0;
+size_t cc_symbol_index::_fused_lexer::_lex_character(size_t limit){
+    size_t dfa_state = _character.state;
+    size_t begin = _character.begin;
+    size_t i = _character.pos;
 
-    for (size_t i = 0; i < scontext.length(); ++i){
-        char input_ch = scontext.content()[i];
+    for (; i < limit; ++i){
+        if (dfa_state != 2){
+            i = _skip(i, limit, ccf_character);
+            if (i >= limit){ break; }
+        }
+        char input_ch = _scontext.at(i);
 
         switch (dfa_state){
         case 0:
@@ -578,7 +1885,7 @@ void cc_symbol_index::_lex_character(cc_stream& scontext){
         case 1:
             if (input_ch == '\''){
                 dfa_state = 0;
-                _add_character_def(scontext, begin, i + 1);
+                _index._add_character_def(_scontext, begin, i + 1);
             }
             else if (input_ch == '\\'){
                 dfa_state = 2;
@@ -589,15 +1896,124 @@ void cc_symbol_index::_lex_character(cc_stream& scontext){
             break;
         }
     }
+
+    _character.state = dfa_state;
+    _character.begin = begin;
+    _character.pos = i;
+    return _settled(_character, dfa_state != 0, limit);
 }
 
-void cc_symbol_index::_lex_method(const cc_stream& ccs){
-    size_t dfa_state = 0;
-    size_t begin = -1, end = -1;
-    string mname;
+size_t cc_symbol_index::_fused_lexer::_lex_preprocessor(size_t limit){
+    size_t dfa_state = _preprocessor.state;
+    size_t start_pos = _preprocessor.begin;
+    size_t i = _preprocessor.pos;
 
-    for (size_t i = 0; i < ccs.length(); ++i){
-        char input_ch = ccs.content()[i];
+    for (; i < limit; ++i){
+        if (dfa_state == 0){
+            i = _skip(i, limit, ccf_preprocessor);
+            if (i >= limit){ break; }
+        }
+        char input_ch = _scontext.at(i);
+
+        // The directive name may only be read once upstream stages have
+        //settled it, retry with the next window
+        if (input_ch == '\n' && dfa_state == 0 && start_pos != size_t(-1)
+            && !_name_settled(start_pos + 1, limit)){
+            break;
+        }
+
+        switch (dfa_state){
+        case 0:
+            if (input_ch == '\\'){
+                dfa_state = 2;
+            }
+            else if (input_ch == '\n'){
+                if (start_pos != size_t(-1)){
+                    _index._add_preprocessor_def(_scontext, start_pos, i);
+                    start_pos = -1;
+                }
+                dfa_state = 1;
+            }
+            break;
+        case 1:
+            if (input_ch == '#'){
+                start_pos = i;
+                dfa_state = 0;
+            }
+            else if (!is_whitespace(input_ch)){
+                dfa_state = 0;
+            }
+            break;
+        case 2:
+            if (input_ch == '\r'){
+                ++i;
+            }
+            dfa_state = 0;
+            break;
+        }
+    }
+
+    _preprocessor.state = dfa_state;
+    _preprocessor.begin = start_pos;
+    _preprocessor.pos = i;
+    return _settled(_preprocessor, start_pos != size_t(-1), limit);
+}
+
+void cc_symbol_index::_fused_lexer::_lex_identifier(size_t limit){
+    size_t dfa_state = _identifier.state;
+    size_t begin = _identifier.begin;
+    size_t i = _identifier.pos;
+
+    for (; i < limit; ++i){
+        if (dfa_state == 0){
+            i = _skip(i, limit, ccf_identifier);
+            if (i >= limit){ break; }
+        }
+        char input_ch = _scontext.at(i);
+
+        switch (dfa_state){
+        case 0:
+            if (is_identifier(input_ch)){
+                dfa_state = 1;
+                begin = i;
+            }
+            break;
+        case 1:
+            if (is_separator(input_ch)){
+                dfa_state = 0;
+                _tokens.push_back(cc_token(begin, i));
+            }
+            break;
+        }
+    }
+
+    if (i >= _length && dfa_state == 1){
+        dfa_state = 0;
+        _tokens.push_back(cc_token(begin, _length));
+    }
+
+    _identifier.state = dfa_state;
+    _identifier.begin = begin;
+    _identifier.pos = i;
+}
+
+/// Summary
+///  Method references are recognized on the original stream
+///
+void cc_symbol_index::_fused_lexer::_lex_method(size_t limit){
+    size_t dfa_state = _method.state;
+    size_t begin = _method.begin, end = _method.end;
+    size_t i = _method.pos;
+
+    static const unsigned char skip_mask[3] = {
+        ccf_identifier, ccf_separator, ccf_non_space
+    };
+
+    for (; i < limit; ++i){
+        i = char_class.skip(_data, i, limit, skip_mask[dfa_state]);
+        if (i >= limit){ break; }
+
+        char input_ch = _data[i];
 
         switch (dfa_state){
         case 0:
@@ -611,8 +2027,8 @@ void cc_symbol_index::_lex_method(const cc_stream& ccs){
                 dfa_state = 0;
                 end = i;
 
-                mname.assign(ccs.content() + begin, end - begin);
-                _method_ref_map[mname].insert(cc_reference(begin, end));
+                _index._method_ref_map.insert(
+                    _index._names.intern(_data + begin, end - begin), cc_reference(begin, end));
             }
             else if (is_whitespace(input_ch)){
                 dfa_state = 2;
@@ -626,8 +2042,8 @@ void cc_symbol_index::_lex_method(const cc_stream& ccs){
             if (input_ch == '('){
                 dfa_state = 0;
 
-                mname.assign(ccs.content() + begin, end - begin);
-                _method_ref_map[mname].insert(cc_reference(begin, end));
+                _index._method_ref_map.insert(
+                    _index._names.intern(_data + begin, end - begin), cc_reference(begin, end));
             }
             else if (is_identifier(input_ch)){
                 dfa_state = 1;
@@ -639,6 +2055,400 @@ void cc_symbol_index::_lex_method(const cc_stream& ccs){
             break;
         }
     }
+
+    _method.state = dfa_state;
+    _method.begin = begin;
+    _method.end = end;
+    _method.pos = i;
+}
+
+/// Summary
+///  Check whether cc_stream::read_name starting from <p> only looks at bytes
+/// before <limit>
+///
+bool cc_symbol_index::_fused_lexer::_name_settled(size_t p, size_t limit) const{
+    if (limit >= _length){
+        return true;
+    }
+
+    for (; p < limit && is_whitespace(_scontext.at(p)); ++p);
+    if (p < limit && is_identifier(_scontext.at(p))){
+        for (; p < limit && !is_separator(_scontext.at(p)); ++p);
+    }
+    return p < limit;
+}
+
+/// Summary
+///  Returns the first position in [<p>, <end>) of the scrubbed stream whose
+/// character has any of <mask> set, or <end> if there is none
+///
+///  Erased characters read as spaces, which have none of the masks used by
+/// the stages, so an erased run is skipped as a whole except for its LFs
+///
+size_t cc_symbol_index::_fused_lexer::_skip(size_t p, size_t end, unsigned char mask) const{
+    bool stop_at_lf = (char_class.flags[(unsigned char)'\n'] & mask) != 0;
+
+    for (;;){
+        p = char_class.skip(_data, p, end, mask);
+        if (p >= end || !_scontext.is_erased(p)){
+            return p;
+        }
+
+        size_t q = min(_scontext.skip_erased(p), end);
+        if (stop_at_lf){
+            const char* lf = static_cast<const char*>(memchr(_data + p, '\n', q - p));
+            if (lf){
+                return lf - _data;
+            }
+        }
+        p = q;
+    }
+}
+
+const char* cc_parse_profile::name(phase p){
+    static const char* const names[phase_count] = {
+        "fused_lex",
+        "index_pairs",
+        "intern_names",
+        "resolve_macro_ref",
+        "resolve_keyword_ref",
+        "lex_enumeration",
+        "lex_class",
+        "resolve_class_ref",
+        "resolve_enum_ref",
+        "resolve_constant_ref",
+        "resolve_external_type_ref",
+        "resolve_external_scope_ref",
+        "seal"
+    };
+    return names[p];
+}
+
+const char* cc_parse_profile::name(reference_map m){
+    static const char* const names[reference_map_count] = {
+        "keyword",
+        "method",
+        "class",
+        "enum",
+        "constant",
+        "macro",
+        "external_type",
+        "external_scope"
+    };
+    return names[m];
+}
+
+void cc_parse_profile::add(const cc_parse_profile& r){
+    for (int i = 0; i < phase_count; ++i){
+        seconds[i] += r.seconds[i];
+    }
+    for (int i = 0; i < reference_map_count; ++i){
+        references[i] += r.references[i];
+    }
+    tokens += r.tokens;
+    peak_token_bytes = std::max(peak_token_bytes, r.peak_token_bytes);
+    peak_name_bytes = std::max(peak_name_bytes, r.peak_name_bytes);
+    peak_arena_bytes = std::max(peak_arena_bytes, r.peak_arena_bytes);
+}
+
+/// Summary
+///  Adds the time since the previous lap to a phase of <profile>, if any
+///
+class cc_phase_clock {
+public:
+    explicit cc_phase_clock(cc_parse_profile* profile) : _profile(profile) {
+        if (_profile){
+            _last = std::chrono::steady_clock::now();
+        }
+    }
+
+    void lap(cc_parse_profile::phase p){
+        if (_profile){
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            _profile->seconds[p] += std::chrono::duration<double>(now - _last).count();
+            _last = now;
+        }
+    }
+
+private:
+    cc_parse_profile*                       _profile;
+    std::chrono::steady_clock::time_point   _last;
+};
+
+cc_symbol_index::cc_symbol_index()
+    :_include_def_list(cc_name_def_list::allocator_type(&_arena)),
+     _comment_def_list(cc_name_def_list::allocator_type(&_arena)),
+     _string_def_list(cc_name_def_list::allocator_type(&_arena)),
+     _character_def_list(cc_name_def_list::allocator_type(&_arena)),
+     _enum_def_list(cc_enum_def_list::allocator_type(&_arena)),
+     _class_def_list(cc_class_def_list::allocator_type(&_arena)),
+     _macro_def_list(cc_name_def_list::allocator_type(&_arena)),
+     _profile(0),
+     _multi_pass(false),
+     _preprocessor_def_list(cc_preprocessor_def_list::allocator_type(&_arena)) {}
+
+bool cc_symbol_index::parse_stream(const cc_stream& ccs){
+    return _parse(ccs, 0);
+}
+
+bool cc_symbol_index::parse_window(const cc_stream& ccs, const cc_symbol_index& outline){
+    return _parse(ccs, &outline);
+}
+
+/// Summary
+///  parse_stream(), resolving names with the definitions of <outline> as well
+/// if it is not 0
+///
+bool cc_symbol_index::_parse(const cc_stream& ccs, const cc_symbol_index* outline){
+    clear();
+    cc_phase_clock clock(_profile);
+    cc_stream scontext;
+    scontext.attach(ccs);
+
+    // Comments, strings, characters and preprocessors should
+    //be processed first, they are lexed in a single pass together with
+    //identifiers and method references
+    //
+    cc_token_list tokens;
+    for (size_t line = 0; line < ccs.line_count(); line += checkpoint_lines){
+        cc_lex_checkpoint cp;
+        cp.line = line;
+        cp.pos = ccs.line_begin(line);
+        _checkpoints.push_back(cp);
+    }
+    _fused_lexer(*this, ccs, scontext, tokens).run(_checkpoints);
+    clock.lap(cc_parse_profile::phase_fused_lex);
+    scontext.index_pairs();
+    clock.lap(cc_parse_profile::phase_index_pairs);
+
+    _intern_names(ccs, tokens);
+    clock.lap(cc_parse_profile::phase_intern_names);
+
+    // _resolve_xxx_ref methods mark the identifiers they resolve as
+    //classified and skip classified ones, thus the calling order implies the
+    //priority of each type resolution.
+    //
+    _resolve_macro_ref(scontext, tokens, *this);
+    clock.lap(cc_parse_profile::phase_resolve_macro_ref);
+    _resolve_keyword_ref(scontext, tokens);
+    _keyword_ref_map.seal(_names);
+    clock.lap(cc_parse_profile::phase_resolve_keyword_ref);
+
+    // Handle type definitions
+    _lex_enumeration(scontext);
+    clock.lap(cc_parse_profile::phase_lex_enumeration);
+    _lex_class(scontext);
+    clock.lap(cc_parse_profile::phase_lex_class);
+
+    // Resolve user type references
+    _resolve_class_ref(scontext, tokens, *this);
+    if (outline){
+        _resolve_class_ref(scontext, tokens, *outline);
+    }
+    clock.lap(cc_parse_profile::phase_resolve_class_ref);
+    _resolve_enum_ref(scontext, tokens, *this);
+    if (outline){
+        _resolve_enum_ref(scontext, tokens, *outline);
+    }
+    clock.lap(cc_parse_profile::phase_resolve_enum_ref);
+    _resolve_constant_ref(scontext, tokens, *this); // enum constant
+    if (outline){
+        _resolve_constant_ref(scontext, tokens, *outline);
+    }
+    clock.lap(cc_parse_profile::phase_resolve_constant_ref);
+
+    // External types of the outline are taken together with those found here
+    _resolve_external_type_ref(scontext, tokens, outline ? *outline : *this);
+    clock.lap(cc_parse_profile::phase_resolve_external_type_ref);
+    _resolve_external_scope_ref(scontext, tokens);
+    clock.lap(cc_parse_profile::phase_resolve_external_scope_ref);
+
+    _seal();
+    clock.lap(cc_parse_profile::phase_seal);
+
+    if (_profile){
+        _count_profile(tokens);
+    }
+    return true;
+}
+
+bool cc_symbol_index::parse_lines(const cc_stream& ccs, const cc_symbol_index& outline,
+                                  size_t first, size_t last){
+    clear();
+    last = min(last, ccs.line_count());
+    if (first >= last){
+        return true;
+    }
+
+    // The last checkpoint at or before <first>, none means from the beginning
+    const cc_lex_checkpoint_list& cps = outline._checkpoints;
+    const cc_lex_checkpoint* cp = 0;
+    for (size_t i = 0; i < cps.size() && cps[i].line <= first; ++i){
+        cp = &cps[i];
+    }
+    if (cp && (cp->line >= ccs.line_count() || cp->pos != ccs.line_begin(cp->line))){
+        return false;
+    }
+
+    cc_phase_clock clock(_profile);
+    cc_stream scontext;
+    scontext.attach(ccs);
+
+    cc_token_list tokens;
+    _fused_lexer(*this, ccs, scontext, tokens).resume(cp, ccs.line_end(last - 1));
+    clock.lap(cc_parse_profile::phase_fused_lex);
+    scontext.index_pairs();
+    clock.lap(cc_parse_profile::phase_index_pairs);
+
+    _intern_names(ccs, tokens);
+    clock.lap(cc_parse_profile::phase_intern_names);
+
+    // Same order as parse_stream(), the type definitions come from <outline>
+    _resolve_macro_ref(scontext, tokens, outline);
+    clock.lap(cc_parse_profile::phase_resolve_macro_ref);
+    _resolve_keyword_ref(scontext, tokens);
+    _keyword_ref_map.seal(_names);
+    clock.lap(cc_parse_profile::phase_resolve_keyword_ref);
+
+    _resolve_class_ref(scontext, tokens, outline);
+    clock.lap(cc_parse_profile::phase_resolve_class_ref);
+    _resolve_enum_ref(scontext, tokens, outline);
+    clock.lap(cc_parse_profile::phase_resolve_enum_ref);
+    _resolve_constant_ref(scontext, tokens, outline);
+    clock.lap(cc_parse_profile::phase_resolve_constant_ref);
+    _resolve_external_type_ref(scontext, tokens, outline);
+    clock.lap(cc_parse_profile::phase_resolve_external_type_ref);
+    _resolve_external_scope_ref(scontext, tokens);
+    clock.lap(cc_parse_profile::phase_resolve_external_scope_ref);
+
+    _seal();
+    clock.lap(cc_parse_profile::phase_seal);
+
+    if (_profile){
+        _count_profile(tokens);
+    }
+    return true;
+}
+
+/// Summary
+///  Add <id> to the set of names <ids>, returns whether it was there already
+///
+static bool mark_name(vector<bool>& ids, size_t id){
+    if (id >= ids.size()){
+        ids.resize(id + 1);
+    }
+    bool marked = ids[id];
+    ids[id] = true;
+    return marked;
+}
+
+void cc_symbol_index::add_outline(const cc_symbol_index& index, size_t begin, size_t end){
+    // Names of the definitions already in the outline
+    vector<bool> classes, enums;
+    for (cc_class_def_list::const_iterator cd = _class_def_list.begin();
+         cd != _class_def_list.end(); ++cd){
+        mark_name(classes, _names.intern(cd->name.data(), cd->name.size()));
+    }
+    for (cc_enum_def_list::const_iterator ed = _enum_def_list.begin();
+         ed != _enum_def_list.end(); ++ed){
+        mark_name(enums, _names.intern(ed->name.data(), ed->name.size()));
+    }
+
+    // Unnamed classes resolve nothing, unnamed enums are told apart by their
+    //position only and all keep their constants
+    //
+    for (cc_class_def_list::const_iterator cd = index._class_def_list.begin();
+         cd != index._class_def_list.end(); ++cd){
+        if (cd->name_ref.begin < begin || cd->name_ref.begin >= end
+            || cd->name_ref.begin == cd->name_ref.end){
+            continue;
+        }
+        size_t id = _names.intern(cd->name.data(), cd->name.size());
+        if (!mark_name(classes, id)){
+            _class_def_list.push_back(cc_class_def(&_arena));
+            _class_def_list.back() = *cd;
+        }
+    }
+    for (cc_enum_def_list::const_iterator ed = index._enum_def_list.begin();
+         ed != index._enum_def_list.end(); ++ed){
+        if (ed->name_ref.begin < begin || ed->name_ref.begin >= end){
+            continue;
+        }
+        bool unnamed = ed->name_ref.begin == ed->name_ref.end;
+        if (unnamed || !mark_name(enums, _names.intern(ed->name.data(), ed->name.size()))){
+            _enum_def_list.push_back(cc_enum_def(&_arena));
+            _enum_def_list.back() = *ed;
+        }
+    }
+
+    const cc_reference_table& types = index._external_type_ref_map;
+    for (size_t g = 0; g < types.size(); ++g){
+        const cc_reference* ref = types.begin(g);
+        for (; ref != types.end(g) && ref->begin < begin; ++ref);
+        if (ref == types.end(g) || ref->begin >= end){
+            continue;
+        }
+
+        size_t name = types.name_id(g);
+        size_t id = _names.intern(index._names.data(name), index._names.length(name));
+        if (!_external_type_ref_map.count(id)){
+            _external_type_ref_map.insert(id, *ref);
+        }
+    }
+    _external_type_ref_map.seal(_names);
+}
+
+/// Summary
+///  Pool the names of <tokens> and note which of them are keywords
+///
+///  Resolvers compare names by their ids in the pool, identifiers never
+/// contain erased characters, so the original content is interned
+///
+void cc_symbol_index::_intern_names(const cc_stream& ccs, cc_token_list& tokens){
+    for (cc_token_list::iterator it = tokens.begin(); it != tokens.end(); ++it){
+        it->name_id = _names.intern(ccs.content() + it->name_ref.begin, it->name_ref.length());
+    }
+
+    _keyword_names.resize(_names.size());
+    for (size_t id = 0; id < _names.size(); ++id){
+        _keyword_names[id] = _keywords.count(_names.data(id), _names.length(id));
+    }
+}
+
+/// Summary
+///  Group the references once every resolver is done
+///
+void cc_symbol_index::_seal(){
+    // Keywords followed by '(' are not methods
+    _method_ref_map.erase(_keyword_names);
+
+    _method_ref_map.seal(_names);
+    _class_ref_map.seal(_names);
+    _enum_ref_map.seal(_names);
+    _constant_ref_map.seal(_names);
+    _macro_ref_map.seal(_names);
+    _external_type_ref_map.seal(_names);
+    _external_scope_ref_map.seal(_names);
+}
+
+/// Summary
+///  Add the counts of the stream just parsed into <tokens> to the profile
+///
+void cc_symbol_index::_count_profile(const cc_token_list& tokens){
+    const cc_reference_table* maps[cc_parse_profile::reference_map_count] = {
+        &_keyword_ref_map, &_method_ref_map, &_class_ref_map, &_enum_ref_map,
+        &_constant_ref_map, &_macro_ref_map, &_external_type_ref_map,
+        &_external_scope_ref_map
+    };
+    for (int i = 0; i < cc_parse_profile::reference_map_count; ++i){
+        _profile->references[i] += maps[i]->end() - maps[i]->begin();
+    }
+
+    _profile->tokens += tokens.size();
+    _profile->peak_token_bytes = std::max(_profile->peak_token_bytes,
+                                          tokens.capacity() * sizeof(cc_token));
+    _profile->peak_name_bytes = std::max(_profile->peak_name_bytes, _names.text_size());
+    _profile->peak_arena_bytes = std::max(_profile->peak_arena_bytes, _arena.used());
 }
 
 void cc_symbol_index::_lex_enumeration(const cc_stream& ccs){
@@ -646,10 +2456,10 @@ void cc_symbol_index::_lex_enumeration(const cc_stream& ccs){
     size_t begin = -1;
 
     string val;
-    cc_enum_def empty_enum;
+    cc_enum_def empty_enum(&_arena);
 
     for (size_t i = 0; i < ccs.length(); ++i){
-        char input_ch = ccs.content()[i];
+        char input_ch = ccs.at(i);
 
         switch (dfa_state){
         case 0:
@@ -703,7 +2513,7 @@ void cc_symbol_index::_lex_enumeration(const cc_stream& ccs){
             break;
         case 8:
             if (is_separator(input_ch)) {
-                val.assign(ccs.content(), begin, i - begin);
+                ccs.read(cc_reference(begin, i), val);
                 _enum_def_list.rbegin()->add_value(val, begin);
 
                 switch (input_ch){
@@ -726,97 +2536,67 @@ void cc_symbol_index::_lex_enumeration(const cc_stream& ccs){
 /// Summary
 ///  Parse class declarations and definitions
 ///  This method uses _keyword_ref_map to find class declarations and definitions,
-///thus _lex_keyword should be called prior to this method to initialize _keyword_ref_map
+///thus _resolve_keyword_ref should be called and _keyword_ref_map sealed prior
+///to this method
 ///
 void cc_symbol_index::_lex_class(const cc_stream& ccs){
-    const char* data = ccs.content();
+    cc_scope_vect::allocator_type arena(&_arena);
+    cc_scope_vect cname(arena);
+    cc_class_def  class_def(&_arena);
 
-    string_vect  cname;
-    cc_class_def class_def;
-
-    cc_class_key_set::const_iterator key_type;
-    for (key_type = _class_key.begin(); key_type != _class_key.end(); ++key_type){
-        class_def.key_name = *key_type;
+    for (size_t key = 0; key < _class_key.size(); ++key){
+        class_def.key_name = _class_key[key].text;
 
         // Find class_key references
-        cc_reference_map::const_iterator key_ref_set = _keyword_ref_map.find(*key_type);
-        if (key_ref_set != _keyword_ref_map.end()){
-            // Traverse references of keyword
-            cc_reference_set::const_iterator key_ref;
-            for (key_ref = key_ref_set->second.begin();
-                 key_ref != key_ref_set->second.end(); ++key_ref){
-                // Class is defined or declared right after the keyword
-                for (size_t i = key_ref->end; i < ccs.length(); ++i){
-                    // Look for where the class header ends
-                    if (data[i] == ';' || data[i] == '{') {
-                        size_t pos = key_ref->end;
-
-                        // Give the class a default name by the position where
-                        //it's defined or declared
-                        class_def.set_name(pos);
-
-                        // If the class got a name, read it
-                        if (ccs.read_complete_name(pos, cname)){
-                            class_def.name = *cname.rbegin();
-                            cname.pop_back();
-                            class_def.nested_name.swap(cname);
-                            class_def.set_name_ref_end(pos);
-                        }
-                        else if (data[i] == ';'){
-                            // An unnamed class declaration !?
-                            break;
-                        }
-
-                        // If the class is defined, find out its member declaration
-                        if (data[i] == '{'){
-                            ccs.find_pair(class_def.body_ref, i);
-                        }
-
-                        _class_def_list.push_back(class_def);
-                        break;
+        size_t key_group = _keyword_ref_map.find(
+            _names, _class_key[key].text, _class_key[key].length);
+        if (key_group != cc_reference_table::npos){
+            // Traverse references of keyword, they are in position order so
+            //the end of the previous class header is reused while it lies
+            //behind the keyword
+            size_t header_end = 0;
+            const cc_reference* key_ref;
+            for (key_ref = _keyword_ref_map.begin(key_group);
+                 key_ref != _keyword_ref_map.end(key_group); ++key_ref){
+                // Class is defined or declared right after the keyword,
+                //look for where the class header ends
+                if (header_end < key_ref->end){
+                    header_end = key_ref->end;
+                    while (header_end < ccs.length()
+                           && ccs.at(header_end) != ';' && ccs.at(header_end) != '{'){
+                        ++header_end;
                     }
                 }
-            }
-        }
-    }
-}
+                if (header_end >= ccs.length()){
+                    break;
+                }
 
-void cc_symbol_index::_lex_preprocessor(cc_stream& scontext){
-    cc_preprocessor_def preprocessor_def;
+                size_t i = header_end;
+                size_t pos = key_ref->end;
 
-    size_t dfa_state = 1;
-    size_t start_pos = -1;
-    for (size_t i = 0; i < scontext.length(); ++i){
-        char input_ch = scontext.content()[i];
+                // Give the class a default name by the position where
+                //it's defined or declared
+                class_def.set_name(pos);
 
-        switch (dfa_state){
-        case 0:
-            if (input_ch == '\\'){
-                dfa_state = 2;
-            }
-            else if (input_ch == '\n'){
-                if (start_pos != -1){
-                    _add_preprocessor_def(scontext, start_pos, i);
-                    start_pos = -1;
+                // If the class got a name, read it
+                if (ccs.read_complete_name(pos, cname)){
+                    class_def.name = *cname.rbegin();
+                    cname.pop_back();
+                    class_def.nested_name.swap(cname);
+                    class_def.set_name_ref_end(pos);
                 }
-                dfa_state = 1;
-            }
-            break;
-        case 1:
-            if (input_ch == '#'){
-                start_pos = i;
-                dfa_state = 0;
-            }
-            else if (!is_whitespace(input_ch)){
-                dfa_state = 0;
-            }
-            break;
-        case 2:
-            if (input_ch == '\r'){
-                ++i;
+                else if (ccs.at(i) == ';'){
+                    // An unnamed class declaration !?
+                    continue;
+                }
+
+                // If the class is defined, find out its member declaration
+                if (ccs.at(i) == '{'){
+                    ccs.find_pair(class_def.body_ref, i);
+                }
+
+                _class_def_list.push_back(class_def);
             }
-            dfa_state = 0;
-            break;
         }
     }
 }
@@ -846,106 +2626,151 @@ void cc_symbol_index::_lex_include(cc_preprocessor_def& pdef, cc_stream& scontex
     }
 }
 
-void cc_symbol_index::_resolve_keyword_ref(cc_name_def_list& id_list){
-    for (cc_name_def_list::iterator id = id_list.begin(); id != id_list.end();){
-        if (_keywords.count(id->name)){
-            _keyword_ref_map[id->name].insert(id->name_ref);
-            id = id_list.erase(id);
+/// Summary
+///  Index of the first token at or after <i> that is not classified yet
+///
+static size_t next_token(const cc_token_list& tokens, size_t i){
+    while (i < tokens.size() && tokens[i].classified){
+        ++i;
+    }
+    return i;
+}
+
+void cc_symbol_index::_resolve_keyword_ref(const cc_stream&, cc_token_list& tokens){
+    for (cc_token_list::iterator id = tokens.begin(); id != tokens.end(); ++id){
+        if (!id->classified && _keyword_names[id->name_id]){
+            _keyword_ref_map.insert(id->name_id, id->name_ref);
+            id->classified = true;
         }
-        else { ++id; }
     }
 }
 
-void cc_symbol_index::_resolve_constant_ref(cc_name_def_list& id_list){
-    set<string> constants;
-    for (cc_enum_def_list::const_iterator enum_def = _enum_def_list.begin();
-         enum_def != _enum_def_list.end(); ++enum_def){
+void cc_symbol_index::_resolve_constant_ref(const cc_stream&, cc_token_list& tokens,
+                                            const cc_symbol_index& defs){
+    vector<bool> constants(_names.size());
+    bool found = false;
+    for (cc_enum_def_list::const_iterator enum_def = defs._enum_def_list.begin();
+         enum_def != defs._enum_def_list.end(); ++enum_def){
         for (cc_name_def_list::const_iterator ev = enum_def->value_def_list.begin();
              ev != enum_def->value_def_list.end(); ++ev){
-            constants.insert(ev->name);
+            size_t id = _names.find(ev->name);
+            if (id != cc_name_pool::npos){
+                constants[id] = true;
+                found = true;
+            }
         }
     }
+    if (!found){
+        return;
+    }
 
-    for (cc_name_def_list::iterator id = id_list.begin(); id != id_list.end();){
-        if (constants.count(id->name)){
-            _constant_ref_map[id->name].insert(id->name_ref);
-            id = id_list.erase(id);
+    for (cc_token_list::iterator id = tokens.begin(); id != tokens.end(); ++id){
+        if (!id->classified && constants[id->name_id]){
+            _constant_ref_map.insert(id->name_id, id->name_ref);
+            id->classified = true;
         }
-        else { ++id; }
     }
 }
 
-void cc_symbol_index::_resolve_class_ref(cc_name_def_list& id_list){
-    return __resolve_type_ref(_class_def_list, id_list, _class_ref_map);
+void cc_symbol_index::_resolve_class_ref(const cc_stream&, cc_token_list& tokens,
+                                         const cc_symbol_index& defs){
+    return __resolve_type_ref(defs._class_def_list, tokens, _class_ref_map);
 }
 
-void cc_symbol_index::_resolve_enum_ref(cc_name_def_list& id_list){
-    return __resolve_type_ref(_enum_def_list, id_list, _enum_ref_map);
+void cc_symbol_index::_resolve_enum_ref(const cc_stream&, cc_token_list& tokens,
+                                        const cc_symbol_index& defs){
+    return __resolve_type_ref(defs._enum_def_list, tokens, _enum_ref_map);
 }
 
-void cc_symbol_index::_resolve_macro_ref(cc_name_def_list& id_list){
-    return __resolve_type_ref(_macro_def_list, id_list, _macro_ref_map);
+void cc_symbol_index::_resolve_macro_ref(const cc_stream&, cc_token_list& tokens,
+                                         const cc_symbol_index& defs){
+    return __resolve_type_ref(defs._macro_def_list, tokens, _macro_ref_map);
 }
 
-void cc_symbol_index::_resolve_external_scope_ref(cc_stream& scontext, cc_name_def_list& id_list){
-    const char* content = scontext.content();
-    size_t max_pos = scontext.length() - 2;
+void cc_symbol_index::_resolve_external_scope_ref(const cc_stream& ccs, cc_token_list& tokens){
+    if (ccs.length() < 2){
+        return;
+    }
+    size_t max_pos = ccs.length() - 2;
+
+    for (cc_token_list::iterator it = tokens.begin(); it != tokens.end(); ++it){
+        if (it->classified){
+            continue;
+        }
 
-    cc_name_def_list::iterator it = id_list.begin();
-    for (; it != id_list.end(); ++it){
         size_t i = it->name_ref.end;
-        while (i < max_pos && is_whitespace(content[i])){
+        while (i < max_pos && is_whitespace(ccs.at(i))){
             ++i;
         }
 
         // Code like enum_type::enum_value is obsolete
         // Thus _enum_ref_map.count(it->name) is not checked
         //
-        if (i < max_pos && content[i] == ':' && content[i + 1] == ':'
-            && !_class_ref_map.count(it->name) && !_macro_ref_map.count(it->name)){
-            _external_scope_ref_map[it->name].insert(it->name_ref);
-            it = id_list.erase(it);
+        if (i < max_pos && ccs.at(i) == ':' && ccs.at(i + 1) == ':'
+            && !_class_ref_map.count(it->name_id) && !_macro_ref_map.count(it->name_id)){
+            _external_scope_ref_map.insert(it->name_id, it->name_ref);
+            it->classified = true;
         }
     }
 }
 
-void cc_symbol_index::_resolve_external_type_ref(cc_stream& scontext, cc_name_def_list& id_list)
+void cc_symbol_index::_resolve_external_type_ref(const cc_stream& ccs, cc_token_list& tokens,
+                                                 const cc_symbol_index& defs)
 {
-    const char* content = scontext.content();
-    if (id_list.size() < 2){
-        return;
-    }
+    // <it> and <next> walk through pairs of adjacent unclassified tokens
+    size_t it = next_token(tokens, 0);
+    size_t next = next_token(tokens, it + 1);
+    while (next < tokens.size()){
+        size_t following = next_token(tokens, next + 1);
 
-    cc_name_def_list::iterator it = id_list.begin();
-    cc_name_def_list::iterator next = it;
-    for (++next; it != id_list.end() && next != id_list.end(); it = next++){
         bool check_external_type = true;
-        for (size_t i = it->name_ref.end; i < next->name_ref.begin; ++i){
-            if (!is_whitespace(content[i])){
+        for (size_t i = tokens[it].name_ref.end; i < tokens[next].name_ref.begin; ++i){
+            if (!is_whitespace(ccs.at(i))){
                 check_external_type = false;
                 break;
             }
         }
-        if (!check_external_type){ continue; }
 
-        if (!_keywords.count(it->name)){
-            _external_type_ref_map[it->name].insert(it->name_ref);
-            next = id_list.erase(it);
-        }
-        else if (!_keywords.count(next->name) && !_class_ref_map.count(next->name)
-                 && (_base_specifiers.count(it->name) || _access_specifiers.count(it->name))){
-            _external_type_ref_map[next->name].insert(next->name_ref);
-            next = id_list.erase(next);
+        if (check_external_type){
+            size_t name = tokens[it].name_id;
+            size_t next_name = tokens[next].name_id;
+            if (!_keyword_names[name]){
+                _external_type_ref_map.insert(name, tokens[it].name_ref);
+                tokens[it].classified = true;
+            }
+            else if (!_keyword_names[next_name] && !_class_ref_map.count(next_name)
+                     && (_base_specifiers.count(_names.data(name), _names.length(name))
+                         || _access_specifiers.count(_names.data(name), _names.length(name)))){
+                _external_type_ref_map.insert(next_name, tokens[next].name_ref);
+                tokens[next].classified = true;
+
+                // the pair after a classified <next> starts behind it
+                next = following;
+                following = next_token(tokens, next + 1);
+            }
         }
 
-        if (next == id_list.end()){ break; }
+        it = next;
+        next = following;
+    }
+
+    // Names <defs> found as external types elsewhere in the stream count too
+    vector<bool> external;
+    if (&defs != this){
+        external.resize(_names.size());
+    }
+    for (size_t g = 0; !external.empty() && g < defs._external_type_ref_map.size(); ++g){
+        size_t name = defs._external_type_ref_map.name_id(g);
+        size_t id = _names.find(defs._names.data(name), defs._names.length(name));
+        if (id != cc_name_pool::npos){
+            external[id] = true;
+        }
     }
 
-    cc_reference_map::iterator ref_set;
-    for (it = id_list.begin(); it != id_list.end(); ++it){
-        ref_set = _external_type_ref_map.find(it->name);
-        if (ref_set != _external_type_ref_map.end()){
-            ref_set->second.insert(it->name_ref);
+    for (cc_token_list::iterator id = tokens.begin(); id != tokens.end(); ++id){
+        if (!id->classified && (_external_type_ref_map.count(id->name_id)
+                                || (!external.empty() && external[id->name_id]))){
+            _external_type_ref_map.insert(id->name_id, id->name_ref);
         }
     }
 }
@@ -989,6 +2814,9 @@ void cc_symbol_index::clear(){
     _preprocessor_def_list.clear();
     _macro_def_list.clear();
 
+    // Nodes of the lists above give nothing back, their memory goes at once
+    _arena.reset();
+
     _enum_ref_map.clear();
     _constant_ref_map.clear();
     _class_ref_map.clear();
@@ -998,4 +2826,8 @@ void cc_symbol_index::clear(){
 
     _external_scope_ref_map.clear();
     _external_type_ref_map.clear();
+
+    _names.clear();
+    _keyword_names.clear();
+    _checkpoints.clear();
 }
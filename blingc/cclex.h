@@ -3,52 +3,210 @@
 #include <string>
 #include <cstring>
 #include <cstdio>
+#include <stdint.h>
 #include <vector>
 #include <set>
 #include <map>
 #include <list>
+#include <cstddef>
+#include <new>
+
+/// Summary
+///  Monotonic allocator, memory is handed out by bumping a pointer through
+/// blocks and is only given back by reset() or release()
+///
+///  Blocks double in size up to block_limit, larger requests get a block of
+/// their own. reset() keeps the blocks to serve the next round, so an arena
+/// that is reset between similar workloads stops asking for memory after the
+/// first one.
+///
+class cc_arena {
+public:
+    enum {
+        alignment = 16,
+        first_block = 4096,
+        block_limit = 1 << 20
+    };
+
+    cc_arena(): _first(0), _current(0), _ptr(0), _end(0), _used(0), _reserved(0) {}
+
+    ~cc_arena() { release(); }
+
+    void* allocate(size_t size) {
+        size = (size + alignment - 1) & ~(size_t)(alignment - 1);
+        if (size > (size_t)(_end - _ptr)){
+            _grow(size);
+        }
+        void* p = _ptr;
+        _ptr += size;
+        _used += size;
+        return p;
+    }
+
+    /// Forget every allocation, the blocks are kept
+    void reset();
+
+    /// Forget every allocation and free all blocks
+    void release();
+
+    /// Bytes handed out since the last reset
+    size_t used() const { return _used; }
+
+    /// Bytes held in blocks
+    size_t reserved() const { return _reserved; }
+
+private:
+    struct block {
+        block*  next;
+        size_t  size;
+    };
+
+    enum { header_size = (sizeof(block) + alignment - 1) & ~(alignment - 1) };
+
+    cc_arena(const cc_arena&);
+    cc_arena& operator=(const cc_arena&);
+
+    void _grow(size_t size);
+
+    block*  _first;
+    block*  _current;   // the block being used, the ones after it are free
+    char*   _ptr;
+    char*   _end;
+    size_t  _used;
+    size_t  _reserved;
+};
+
+/// Summary
+///  STL allocator taking memory from a cc_arena, deallocation does nothing
+///
+///  A default constructed allocator has no arena and goes to the heap, it
+/// serves the definitions built outside of an index. Containers copy the
+/// allocator along with their elements, so a copy of an arena backed
+/// container lives in the same arena.
+///
+template<typename T>
+class cc_arena_allocator {
+public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef const T*        const_pointer;
+    typedef T&              reference;
+    typedef const T&        const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template<typename U> struct rebind {
+        typedef cc_arena_allocator<U> other;
+    };
+
+    cc_arena_allocator(): _arena(0) {}
+
+    explicit cc_arena_allocator(cc_arena* arena): _arena(arena) {}
+
+    template<typename U>
+    cc_arena_allocator(const cc_arena_allocator<U>& a): _arena(a.arena()) {}
+
+    cc_arena* arena() const { return _arena; }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(_arena ? _arena->allocate(n * sizeof(T))
+                                      : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t) {
+        if (!_arena){
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const cc_arena_allocator<U>& a) const { return _arena == a.arena(); }
+
+    template<typename U>
+    bool operator!=(const cc_arena_allocator<U>& a) const { return _arena != a.arena(); }
+
+private:
+    cc_arena*   _arena;
+};
 
 class  cc_stream;
 struct cc_reference;
 struct cc_name_def;
-typedef std::list<cc_name_def> cc_name_def_list;
+struct cc_token;
+typedef std::list<cc_name_def, cc_arena_allocator<cc_name_def> > cc_name_def_list;
+typedef std::vector<cc_token> cc_token_list;
 
 typedef std::vector<std::string>    string_vect;
 typedef std::set<std::string>       string_set;
 
-struct cc_keyword_set: public string_set{
-    cc_keyword_set();
+/// Names of the scopes enclosing a definition
+typedef std::vector<std::string, cc_arena_allocator<std::string> > cc_scope_vect;
 
-private:
-    static char _keywords[128][32];
-};
+/// Summary
+///  Vector instructions the lexers use to skip over the bytes they ignore
+///
+///  The best level the CPU supports is picked at startup. select() lowers it,
+/// to compare with the scalar path for instance, and must not be called while
+/// streams are being parsed.
+///
+struct cc_simd {
+    enum level {
+        scalar,
+        sse2,
+        avx2
+    };
 
-struct cc_class_key_set: public string_set{
-    cc_class_key_set();
+    static level supported();
+    static level current();
 
-private:
-    static char _class_key[3][8];
-};
+    /// Use at most <max>, returns the level now in use
+    static level select(level max);
 
-struct cc_base_specifier_set: public string_set{
-    cc_base_specifier_set();
+    static const char* name(level l);
+};
 
-private:
-    static char _base_specifier[4][16];
+/// Summary
+///  Word of a cc_word_set
+///
+struct cc_word {
+    const char* text;
+    size_t      length;
 };
 
-struct cc_access_specifier_set: public string_set{
-    cc_access_specifier_set();
+/// Summary
+///  Fixed set of words recognized with a perfect hash
+///
+///  Every word hashes to a slot of its own, so a lookup costs one hash and one
+/// compare. The sets are aggregates initialized in the section of cclex.cc
+/// generated by gen_word_sets.py. Words are kept in sorted order.
+///
+struct cc_word_set {
+    bool count(const char* s, size_t n) const;
+
+    bool count(const std::string& s) const {
+        return count(s.data(), s.size());
+    }
 
-private:
-    static char _access_specifier[2][16];
+    size_t size() const { return word_count; }
+
+    const cc_word& operator[](size_t i) const { return words[i]; }
+
+    static uint32_t hash(uint32_t seed, const char* s, size_t n);
+
+    const cc_word*          words;
+    size_t                  word_count;
+    const unsigned char*    slots;      // index + 1 of the word in each slot
+    uint32_t                slot_mask;
+    uint32_t                seed;
+    size_t                  max_length;
 };
+
 /// Summary
 ///  Structure that marks a reference
 ///
 struct cc_reference{
     struct less {
-        bool operator()(const cc_reference& l, const cc_reference& r){
+        bool operator()(const cc_reference& l, const cc_reference& r) const {
             return l.end <= r.begin;
         }
     };
@@ -64,13 +222,181 @@ struct cc_reference{
 };
 
 typedef std::list<cc_reference>                     cc_reference_list;
-typedef std::set<cc_reference, cc_reference::less>  cc_reference_set;
-typedef std::map<std::string, cc_reference_set>     cc_reference_map;
+
+/// Summary
+///  Interns identifier names, every distinct name gets a dense id counted
+/// from 0 in the order it is first seen
+///
+class cc_name_pool {
+public:
+    static const size_t npos = (size_t)-1;
+
+    cc_name_pool(): _offsets(1, 0) {}
+
+    /// Returns the id of the name, the name is added if it is not pooled yet
+    size_t intern(const char* s, size_t n);
+
+    /// Returns the id of the name, or npos if it is not pooled
+    size_t find(const char* s, size_t n) const;
+
+    size_t find(const std::string& s) const {
+        return find(s.data(), s.size());
+    }
+
+    /// Pooled names are null terminated
+    const char* data(size_t id) const { return &_text[_offsets[id]]; }
+
+    size_t length(size_t id) const {
+        return _offsets[id + 1] - _offsets[id] - 1;
+    }
+
+    std::string name(size_t id) const {
+        return std::string(data(id), length(id));
+    }
+
+    size_t size() const { return _offsets.size() - 1; }
+
+    /// Bytes of name text held, terminators included
+    size_t text_size() const { return _text.size(); }
+
+    void clear();
+
+private:
+    size_t _probe(const char* s, size_t n, uint32_t h) const;
+    void _grow();
+
+private:
+    std::vector<char>       _text;      // names, one after another
+    std::vector<size_t>     _offsets;   // where each name starts, and the end
+    std::vector<uint32_t>   _hashes;    // hash of each name
+    std::vector<uint32_t>   _slots;     // id + 1 of the name in each slot
+};
+
+/// Summary
+///  References of one category grouped by name id
+///
+///  References are appended to a postings array while parsing. seal() groups
+/// them with a counting sort on the name id, groups are then ordered by name
+/// and the references of a group by position, overlapping ones are dropped.
+/// Groups are only available after seal().
+///
+class cc_reference_table {
+public:
+    static const size_t npos = (size_t)-1;
+
+    void insert(size_t id, const cc_reference& ref) {
+        if (id >= _present.size()){
+            _present.resize(id + 1);
+        }
+        _present[id] = true;
+        _postings.push_back(posting(id, ref));
+    }
+
+    /// Whether references of name <id> were inserted
+    bool count(size_t id) const {
+        return id < _present.size() && _present[id];
+    }
+
+    /// Drop the references of every name id flagged in <ids>
+    void erase(const std::vector<bool>& ids);
+
+    /// Group the inserted references, <names> is the pool of the name ids
+    void seal(const cc_name_pool& names);
+
+    void clear();
+
+    /// Number of groups
+    size_t size() const { return _groups.size(); }
+
+    size_t name_id(size_t g) const { return _groups[g].id; }
+
+    const cc_reference* begin(size_t g) const { return _at(_groups[g].first); }
+    const cc_reference* end(size_t g) const { return _at(_groups[g].last); }
+
+    /// All references, one group after another
+    const cc_reference* begin() const { return _at(0); }
+    const cc_reference* end() const { return _at(_refs.size()); }
+
+    /// Returns the group of the name, or npos if it has no references
+    size_t find(const cc_name_pool& names, const char* s, size_t n) const;
+
+private:
+    struct posting {
+        posting(size_t i, const cc_reference& r): id(i), ref(r) {}
+
+        size_t          id;
+        cc_reference    ref;
+    };
+
+    struct group {
+        group(size_t i, size_t f, size_t l): id(i), first(f), last(l) {}
+
+        size_t  id;
+        size_t  first;
+        size_t  last;
+    };
+
+    struct name_less;
+
+    const cc_reference* _at(size_t i) const {
+        return _refs.empty() ? 0 : &_refs[0] + i;
+    }
+
+    void _unseal();
+
+private:
+    std::vector<posting>        _postings;  // references not grouped yet
+    std::vector<cc_reference>   _refs;      // grouped references
+    std::vector<group>          _groups;    // groups in name order
+    std::vector<bool>           _present;   // whether each name id is inserted
+};
+
+/// Summary
+///  Read only view of a cc_reference_table, names of the groups are read
+/// from the name pool of the symbol index
+///
+class cc_reference_view {
+public:
+    static const size_t npos = (size_t)-1;
+
+    cc_reference_view(const cc_reference_table& table, const cc_name_pool& names)
+        : _table(&table), _names(&names) {}
+
+    /// Number of distinct names
+    size_t size() const { return _table->size(); }
+
+    bool empty() const { return _table->size() == 0; }
+
+    std::string name(size_t g) const {
+        return _names->name(_table->name_id(g));
+    }
+
+    /// References of group <g>, ordered by position
+    const cc_reference* begin(size_t g) const { return _table->begin(g); }
+    const cc_reference* end(size_t g) const { return _table->end(g); }
+
+    /// All references, one group after another
+    const cc_reference* begin() const { return _table->begin(); }
+    const cc_reference* end() const { return _table->end(); }
+
+    /// Returns the group of <name>, or npos if it has no references
+    size_t find(const std::string& name) const {
+        return _table->find(*_names, name.data(), name.size());
+    }
+
+private:
+    const cc_reference_table*   _table;
+    const cc_name_pool*         _names;
+};
 
 /// Summary
 ///  C++ source stream, an encapsulation of C++ source buffer
 ///  Support source files encoded with ANSI or UTF-8
 ///
+///  The buffer of a stream is never written to. Erased bytes are recorded
+/// in an overlay, at() and the parsing methods read the content with the
+/// overlay applied while content() returns the original bytes.
+///
 class cc_stream {
 public:
     cc_stream();
@@ -78,18 +404,47 @@ public:
     explicit cc_stream(const char* fileName);
     virtual ~cc_stream();
 
-    /// Create stream from a C++ source file
+    /// Summary
+    ///  Create stream from a C++ source file
+    ///  Regular files are mapped into memory read-only
+    ///
     bool open(const char* fileName);
 
+    /// Summary
+    ///  Create stream from a copy of <size> bytes of source in memory
+    ///
+    bool assign(const char* data, size_t size);
+
+    /// Summary
+    ///  Create stream that shares the content of <base> without copying it
+    ///  <base> must not be closed while this stream is open
+    ///
+    bool attach(const cc_stream& base);
+
     /// Close the stream object
     bool close();
 
     /// Summary
-    ///  Erase the stream content from <beg> to <end> with <ch>
+    ///  Erase the stream content from <beg> to <end> with spaces
     ///  LFs will not be touched
     ///
     size_t erase(size_t beg, size_t end);
 
+    bool is_erased(size_t p) const {
+        return !_erased.empty() && ((_erased[p / 64] >> (p % 64)) & 1);
+    }
+
+    /// Summary
+    ///  Returns the first position from <p> that is not erased
+    ///
+    size_t skip_erased(size_t p) const;
+
+    /// Read the character at <p>, erased characters are read as spaces
+    char at(size_t p) const {
+        char ch = _content[p];
+        return (ch != '\n' && is_erased(p)) ? ' ' : ch;
+    }
+
     /// Summary
     ///  Read a identifier name from the given position <p>
     ///  Heading spaces are ignored
@@ -115,12 +470,12 @@ public:
     ///  This method returns true if p points to a valid identifier name,
     ///otherwise returns false
     ///
-    bool read_complete_name(size_t& p, string_vect& sv) const;
+    bool read_complete_name(size_t& p, cc_scope_vect& sv) const;
 
     /// Summary
     ///  Parse C++ identifiers from <begin> to <end>
     ///
-    bool parse_identifier(cc_name_def_list& id_list, size_t begin = 0, size_t end = -1) const;
+    bool parse_identifier(cc_token_list& tokens, size_t begin = 0, size_t end = -1) const;
 
     /// Summary
     ///  Search paired characters recursively.
@@ -133,21 +488,36 @@ public:
     /// Returns
     ///  This method returns true if the pair is found, otherwise returns false
     ///  <pair_pos> returns the position of the first pair that found
+    ///
+    ///  Pairs of the predefined bracket types are looked up in the table built
+    /// by index_pairs() if it is up to date
     ///  
     bool find_pair(cc_reference& pair_pos, size_t begin, size_t end = -1,
         const std::pair<char, char>& ptype = cc_stream::brace) const;
 
+    /// Summary
+    ///  Match the braces, round, square and angle brackets of the stream in
+    /// a single pass, erased characters are skipped
+    ///  The table is dropped when the stream is erased
+    ///
+    void index_pairs();
+
     /// Summary
     ///  Read the referred content pointed by <wdref> from stream and append it to <wd>
     ///  This method does NOT check the boundary
     ///
     bool read(const cc_reference& wdref, std::string& wd) const {
         wd.assign(_content+wdref.begin, wdref.length());
+        for (size_t i = 0; !_erased.empty() && i < wd.length(); ++i){
+            wd[i] = at(wdref.begin + i);
+        }
         return true;
     }
 
     /// Summary
     ///  Locate next line from <line.end>
+    ///  <line> returns the range from <line.end> to the end of the line it is
+    /// in, the LF is included. Start with an empty <line> to read them all.
     ///
     /// Returns
     ///  false if <line.end> has reached the end of stream, otherwise this
@@ -155,6 +525,21 @@ public:
     ///
     bool getline(cc_reference& line) const;
 
+    /// Number of lines, the LF that ends the stream closes the last one
+    size_t line_count() const { return _lines.size(); }
+
+    /// Position of the first character of line <n>, counted from 0
+    size_t line_begin(size_t n) const { return _lines[n]; }
+
+    /// Position after the LF that ends line <n>
+    size_t line_end(size_t n) const {
+        return n + 1 < _lines.size() ? _lines[n + 1] : _length;
+    }
+
+    /// Line of the character at <p>, counted from 0
+    size_t line_of(size_t p) const;
+
+    /// Original content of the stream, erased characters are not applied
     const char* content() const { return _content; }
 
     size_t length() const { return _length; }
@@ -162,19 +547,75 @@ public:
     bool is_open() const { return _content != 0; }
 
     int compare_at(size_t p, const char* dst, size_t cch) const {
-        return strncmp(_content+p, dst, cch);
+        for (size_t i = 0; i < cch; ++i, ++p){
+            char ch = at(p);
+            if (ch != dst[i] || !ch){
+                return (unsigned char)ch - (unsigned char)dst[i];
+            }
+        }
+        return 0;
     }
 
 public:
-    static std::pair<char, char>    round_bracket;
-    static std::pair<char, char>    angle_bracket;
-    static std::pair<char, char>    square_bracket;
-    static std::pair<char, char>    brace;
+    static const std::pair<char, char>  round_bracket;
+    static const std::pair<char, char>  angle_bracket;
+    static const std::pair<char, char>  square_bracket;
+    static const std::pair<char, char>  brace;
+
+private:
+    enum storage_type {
+        storage_none,
+        storage_heap,
+        storage_mapped,
+        storage_shared
+    };
+
+    bool _map(int fd, size_t size);
+
+    void _adopt(char* buff);
+
+    void _index_lines();
+
+    static int _pair_type(const std::pair<char, char>& ptype);
+
+    enum { pair_type_count = 4 };
 
 private:
-    char*   _content;
-    size_t  _length;
-    size_t  _buff_size;
+    const char*     _content;
+    size_t          _length;
+    size_t          _buff_size;
+    storage_type    _storage;
+
+    std::vector<uint64_t>   _erased;    // one bit per erased character
+    std::vector<size_t>     _lines;     // position where each line begins
+
+    // Pairs of each bracket type ordered by the opening position, the end of
+    //an unmatched opening bracket is 0
+    std::vector<cc_reference>   _pairs[pair_type_count];
+    bool                        _paired;
+};
+
+/// Summary
+///  Identifier token, its name is the referenced range of the stream
+///
+///  Tokens keep no copy of the name. Resolvers mark the tokens they classify
+///instead of removing them, later resolvers skip the classified ones.
+///
+struct cc_token {
+    cc_token(size_t begin, size_t end)
+        : name_ref(begin, end), name_id(cc_name_pool::npos), classified(false) {}
+
+    /// Copy the name into <buff> and return it, <buff> is reused by callers
+    ///to avoid an allocation per token. Identifiers never contain erased
+    ///characters, so the original content is read.
+    const std::string& name(const cc_stream& s, std::string& buff) const {
+        buff.assign(s.content() + name_ref.begin, name_ref.length());
+        return buff;
+    }
+
+    cc_reference    name_ref;
+    size_t          name_id;    // id in the name pool of the symbol index
+    bool            classified;
 };
 
 struct cc_name_def {
@@ -190,10 +631,10 @@ struct cc_name_def {
         :name(n), name_ref(r) {}
 
     cc_name_def(const cc_stream& s, const cc_reference& r)
-        :name(s.content()+r.begin, r.length()), name_ref(r) {}
+        :name_ref(r) { s.read(name_ref, name); }
 
     cc_name_def(const cc_stream& s, size_t begin, size_t end)
-        :name(s.content()+begin, end-begin), name_ref(begin, end) {}
+        :name_ref(begin, end) { s.read(name_ref, name); }
 
     void set_name(const std::string& n, size_t pos){
         name = n;
@@ -211,7 +652,6 @@ struct cc_name_def {
     }
 };
 
-typedef std::list<cc_name_def> cc_name_def_list;
 /// Summary
 ///  Describes a preprocessor reference
 ///
@@ -219,11 +659,17 @@ struct cc_preprocessor_def: public cc_name_def{
     cc_reference    line_ref;   // Address of preprocessor line
 };
 
-typedef std::list<cc_preprocessor_def>  cc_preprocessor_def_list;
+typedef std::list<cc_preprocessor_def, cc_arena_allocator<cc_preprocessor_def> >
+    cc_preprocessor_def_list;
 
 struct cc_entity_def: public cc_name_def {
-    string_vect  nested_name;
-    cc_reference body_ref;
+    cc_scope_vect   nested_name;
+    cc_reference    body_ref;
+
+    cc_entity_def(){}
+
+    explicit cc_entity_def(cc_arena* arena)
+        :nested_name(cc_scope_vect::allocator_type(arena)) {}
 };
 
 /// Summary
@@ -231,7 +677,12 @@ struct cc_entity_def: public cc_name_def {
 ///
 struct cc_enum_def: public cc_entity_def {
     cc_name_def_list value_def_list;
-    
+
+    cc_enum_def(){}
+
+    explicit cc_enum_def(cc_arena* arena)
+        :cc_entity_def(arena), value_def_list(cc_name_def_list::allocator_type(arena)) {}
+
     bool empty() const {
         return name.size() || value_def_list.size();
     }
@@ -253,12 +704,16 @@ struct cc_enum_def: public cc_entity_def {
     }
 };
 
-typedef std::list<cc_enum_def> cc_enum_def_list;
+typedef std::list<cc_enum_def, cc_arena_allocator<cc_enum_def> > cc_enum_def_list;
 
 /// Summary
 ///  Describes a class definition
 ///
 struct cc_class_def: public cc_entity_def {
+    cc_class_def(){}
+
+    explicit cc_class_def(cc_arena* arena): cc_entity_def(arena) {}
+
     void set_name(size_t pos) {
         char temp[32];
         name.assign(temp, sprintf(temp, "unnamed_class_%p", pos));
@@ -268,10 +723,132 @@ struct cc_class_def: public cc_entity_def {
     std::string     key_name;
 };
 
-typedef std::list<cc_class_def> cc_class_def_list;
+typedef std::list<cc_class_def, cc_arena_allocator<cc_class_def> > cc_class_def_list;
+
+/// Summary
+///  State of the fused lexer where a line begins
+///
+///  parse_stream() takes one every cc_symbol_index::checkpoint_lines lines,
+/// parse_lines() resumes lexing from the nearest one before the lines it is
+/// asked for. Every stage of the lexer keeps the state of its DFA and the
+/// token it is in the middle of.
+///
+struct cc_lex_checkpoint {
+    // Stages of the fused lexer
+    enum {
+        stage_comment,
+        stage_string,
+        stage_character,
+        stage_preprocessor,
+        stage_identifier,
+        stage_method,
+        stage_count
+    };
+
+    struct stage {
+        unsigned char   state;
+        unsigned char   back_state; // state to return to after an escape
+        size_t          begin;      // token being recognized, -1 if none
+        size_t          end;
+    };
+
+    size_t  line;       // counted from 0
+    size_t  pos;        // where the line begins
+    stage   stages[stage_count];
+
+    /// Summary
+    ///  Whether every stage waits for a token to begin, nothing lexed before
+    /// the checkpoint reaches past it then
+    ///
+    bool idle() const {
+        for (int s = 0; s < stage_count; ++s){
+            if (stages[s].state != (s == stage_preprocessor ? 1 : 0)){
+                return false;
+            }
+        }
+        return stages[stage_preprocessor].begin == size_t(-1);
+    }
+};
+
+typedef std::vector<cc_lex_checkpoint> cc_lex_checkpoint_list;
+
+/// Summary
+///  Time spent in each phase of cc_symbol_index::parse_stream, and the size
+/// of what it produced
+///
+///  Times and counts add up over every stream parsed while the profile is set
+/// on the index, peaks are the largest of a single stream. Heap allocations
+/// are not counted, that takes replacing the global operator new, which the
+/// command line does for --stats when built with make HEAP_STATS=1. The fused
+/// lexer covers comments, strings, characters, preprocessors, identifiers and
+/// method references in one pass.
+///
+struct cc_parse_profile {
+    enum phase {
+        phase_fused_lex,
+        phase_index_pairs,
+        phase_intern_names,
+        phase_resolve_macro_ref,
+        phase_resolve_keyword_ref,
+        phase_lex_enumeration,
+        phase_lex_class,
+        phase_resolve_class_ref,
+        phase_resolve_enum_ref,
+        phase_resolve_constant_ref,
+        phase_resolve_external_type_ref,
+        phase_resolve_external_scope_ref,
+        phase_seal,
+        phase_count
+    };
+
+    enum reference_map {
+        ref_keyword,
+        ref_method,
+        ref_class,
+        ref_enum,
+        ref_constant,
+        ref_macro,
+        ref_external_type,
+        ref_external_scope,
+        reference_map_count
+    };
+
+    cc_parse_profile() { clear(); }
+
+    void clear() {
+        for (int i = 0; i < phase_count; ++i) {
+            seconds[i] = 0;
+        }
+        for (int i = 0; i < reference_map_count; ++i) {
+            references[i] = 0;
+        }
+        tokens = 0;
+        peak_token_bytes = 0;
+        peak_name_bytes = 0;
+        peak_arena_bytes = 0;
+    }
+
+    /// Add up the counters of <r>
+    void add(const cc_parse_profile& r);
+
+    static const char* name(phase p);
+
+    static const char* name(reference_map m);
+
+    double  seconds[phase_count];
+    size_t  references[reference_map_count];
+    size_t  tokens;             // identifier tokens lexed
+    size_t  peak_token_bytes;   // token list of a stream
+    size_t  peak_name_bytes;    // name pool of a stream
+    size_t  peak_arena_bytes;   // definitions of a stream
+};
 
 class cc_symbol_index {
 public:
+    enum { checkpoint_lines = 1024 };
+
+    cc_symbol_index();
+
     /// Summary
     ///  Parse C++ source stream
     ///  C/C++ comments, strings and characters will be replaced with spaces 
@@ -282,9 +859,79 @@ public:
     ///
     bool parse_stream(const cc_stream& ccs);
 
+    /// Summary
+    ///  Parse lines [<first>, <last>) of C++ source stream, counted from 0
+    ///
+    ///  <outline> is the index of the whole stream, or its outline read by
+    /// load_outline(). Lexing resumes from its last checkpoint before <first>
+    /// and stops once the tokens reaching into the lines are complete. Names
+    /// are resolved with the definitions of <outline>, so references come out
+    /// as parse_stream() finds them, the lines before the checkpoint aside.
+    ///
+    /// Returns
+    ///  false if the checkpoints of <outline> do not fit the stream
+    ///
+    bool parse_lines(const cc_stream& ccs, const cc_symbol_index& outline,
+                     size_t first, size_t last);
+
+    /// Summary
+    ///  Parse a window of a stream that is read piece by piece
+    ///
+    ///  As parse_stream(), but names are also resolved with the definitions
+    /// of <outline>, which add_outline() collects from the windows before.
+    ///
+    bool parse_window(const cc_stream& ccs, const cc_symbol_index& outline);
+
+    /// Summary
+    ///  Add the class and enum definitions and the external types of <index>
+    /// found in [<begin>, <end>) to this outline
+    ///
+    ///  A name is added once, so an outline grows with the names of a stream
+    /// rather than with its length. Positions of what is added refer to the
+    /// stream of <index>.
+    ///
+    void add_outline(const cc_symbol_index& index, size_t begin, size_t end);
+
     // Clear all symbol index information
     void clear();
 
+    /// Summary
+    ///  Append the index to <buff> as a record of the symbol database
+    ///
+    void save(std::string& buff) const;
+
+    /// Summary
+    ///  Replace the index with a record written by save()
+    ///
+    /// Returns
+    ///  false if the record is malformed, the index is cleared then
+    ///
+    bool load(const char* data, size_t size);
+
+    /// Summary
+    ///  Append what parse_lines() needs of the index to <buff>: the enum,
+    /// class and macro definitions, the checkpoints and the first reference
+    /// of each external type
+    ///
+    void save_outline(std::string& buff) const;
+
+    /// Summary
+    ///  Replace the index with an outline written by save_outline()
+    ///
+    /// Returns
+    ///  false if the outline is malformed, the index is cleared then
+    ///
+    bool load_outline(const char* data, size_t size);
+
+    /// Summary
+    ///  Add the phase times of parse_stream to <profile>, 0 to stop profiling
+    ///
+    void set_profile(cc_parse_profile* profile) { _profile = profile; }
+
+    const cc_lex_checkpoint_list& checkpoints() const {
+        return _checkpoints;
+    }
+
     const cc_enum_def_list& enum_def_list() const {
         return _enum_def_list;
     }
@@ -317,56 +964,66 @@ public:
         return _macro_def_list;
     }
 
-    const cc_reference_map& keyword_ref_map() const {
-        return _keyword_ref_map;
+    cc_reference_view keyword_ref_map() const {
+        return cc_reference_view(_keyword_ref_map, _names);
     }
 
-    const cc_reference_map& method_ref_map() const {
-        return _method_ref_map;
+    cc_reference_view method_ref_map() const {
+        return cc_reference_view(_method_ref_map, _names);
     }
 
-    const cc_reference_map& class_ref_map() const {
-        return _class_ref_map;
+    cc_reference_view class_ref_map() const {
+        return cc_reference_view(_class_ref_map, _names);
     }
 
-    const cc_reference_map& enum_ref_map() const {
-        return _enum_ref_map;
+    cc_reference_view enum_ref_map() const {
+        return cc_reference_view(_enum_ref_map, _names);
     }
 
-    const cc_reference_map& macro_ref_map() const {
-        return _macro_ref_map;
+    cc_reference_view macro_ref_map() const {
+        return cc_reference_view(_macro_ref_map, _names);
     }
 
-    const cc_reference_map& constant_ref_map() const {
-        return _constant_ref_map;
+    cc_reference_view constant_ref_map() const {
+        return cc_reference_view(_constant_ref_map, _names);
     }
 
-    const cc_reference_map& external_type_ref_map() const {
-        return _external_type_ref_map;
+    cc_reference_view external_type_ref_map() const {
+        return cc_reference_view(_external_type_ref_map, _names);
     }
 
-    const cc_reference_map& external_scope_ref_map() const {
-        return _external_scope_ref_map;
+    cc_reference_view external_scope_ref_map() const {
+        return cc_reference_view(_external_scope_ref_map, _names);
     }
 
 private:
-    void _lex_comment(cc_stream& scontext);
-    void _lex_string (cc_stream& scontext);
-    void _lex_character(cc_stream& scontext);
-    void _lex_preprocessor(cc_stream& scontext);
+    class _fused_lexer;
+
     void _lex_include(cc_preprocessor_def& pdef, cc_stream& ccs);
 
-    void _lex_method(const cc_stream& ccs);
     void _lex_enumeration(const cc_stream& ccs);
     void _lex_class(const cc_stream& ccs);
     
-    void _resolve_constant_ref(cc_name_def_list& id_list);
-    void _resolve_keyword_ref(cc_name_def_list& id_list);
-    void _resolve_class_ref(cc_name_def_list& id_list);
-    void _resolve_enum_ref(cc_name_def_list& id_list);
-    void _resolve_macro_ref(cc_name_def_list& id_list);
-    void _resolve_external_scope_ref(cc_stream& scontext, cc_name_def_list& id_list);
-    void _resolve_external_type_ref(cc_stream& scontext, cc_name_def_list& id_list);
+    // Resolvers taking <defs> look names up in its definitions, which are
+    //those of this index unless only some lines are parsed
+    //
+    void _resolve_constant_ref(const cc_stream& ccs, cc_token_list& tokens,
+                               const cc_symbol_index& defs);
+    void _resolve_keyword_ref(const cc_stream& ccs, cc_token_list& tokens);
+    void _resolve_class_ref(const cc_stream& ccs, cc_token_list& tokens,
+                            const cc_symbol_index& defs);
+    void _resolve_enum_ref(const cc_stream& ccs, cc_token_list& tokens,
+                           const cc_symbol_index& defs);
+    void _resolve_macro_ref(const cc_stream& ccs, cc_token_list& tokens,
+                            const cc_symbol_index& defs);
+    void _resolve_external_scope_ref(const cc_stream& ccs, cc_token_list& tokens);
+    void _resolve_external_type_ref(const cc_stream& ccs, cc_token_list& tokens,
+                                    const cc_symbol_index& defs);
+    bool _parse(const cc_stream& ccs, const cc_symbol_index* outline);
+    void _intern_names(const cc_stream& ccs, cc_token_list& tokens);
+    void _seal();
+
+    void _count_profile(const cc_token_list& tokens);
 
     void _add_string_def(cc_stream& scontext, size_t begin, size_t end);
     void _add_comment_def(cc_stream& scontext, size_t begin, size_t end);
@@ -374,23 +1031,37 @@ private:
     void _add_preprocessor_def(cc_stream& scontext, size_t begin, size_t end);
 
 private:
-    template<typename _def_list> void __resolve_type_ref(
-        const _def_list& dl, cc_name_def_list& id_list, cc_reference_map& ref_map) {
-        string_set name_set;
+    template<typename _def_list> void __resolve_type_ref(const _def_list& dl,
+        cc_token_list& tokens, cc_reference_table& ref_map) {
+        // Names that no token uses are not pooled
+        std::vector<bool> name_set(_names.size());
+        bool found = false;
         for (typename _def_list::const_iterator it = dl.begin(); it != dl.end(); ++it) {
-            name_set.insert(it->name);
+            size_t id = _names.find(it->name);
+            if (id != cc_name_pool::npos) {
+                name_set[id] = true;
+                found = true;
+            }
+        }
+        if (!found) {
+            return;
         }
 
-        for (typename cc_name_def_list::iterator id = id_list.begin(); id != id_list.end();) {
-            if (name_set.count(id->name)) {
-                ref_map[id->name].insert(id->name_ref);
-                id = id_list.erase(id);
+        for (cc_token_list::iterator id = tokens.begin(); id != tokens.end(); ++id) {
+            if (!id->classified && name_set[id->name_id]) {
+                ref_map.insert(id->name_id, id->name_ref);
+                id->classified = true;
             }
-            else { ++id; }
         }
     }
 
+private:
+    cc_symbol_index(const cc_symbol_index&);
+    cc_symbol_index& operator=(const cc_symbol_index&);
+
 protected:
+    cc_arena            _arena;                 // backs the definition lists below
+
     cc_name_def_list    _include_def_list;      // included files
     cc_name_def_list    _comment_def_list;      // comment blocks
     cc_name_def_list    _string_def_list;       // set of strings
@@ -400,46 +1071,165 @@ protected:
     cc_class_def_list   _class_def_list;        // list of class definition
     cc_name_def_list    _macro_def_list;        // list of macro definition
 
-    cc_reference_map    _keyword_ref_map;       // references of keywords
-    cc_reference_map    _method_ref_map;        // references of methods
-    cc_reference_map    _class_ref_map;         // references of user classes
-    cc_reference_map    _enum_ref_map;          // references of user enumerations
-    cc_reference_map    _constant_ref_map;      // references of enum constants
-    cc_reference_map    _macro_ref_map;         // references of macros
+    cc_name_pool        _names;                 // names of tokens and methods
+    std::vector<bool>   _keyword_names;         // whether each pooled name is a keyword
+    cc_parse_profile*   _profile;
+
+    // Whether each token type is lexed in a pass of its own over the whole
+    //stream, set by blingc_bench only to compare with the fused lexer
+    bool                _multi_pass;
+    friend class cc_bench_lexer;
+
+    cc_reference_table  _keyword_ref_map;       // references of keywords
+    cc_reference_table  _method_ref_map;        // references of methods
+    cc_reference_table  _class_ref_map;         // references of user classes
+    cc_reference_table  _enum_ref_map;          // references of user enumerations
+    cc_reference_table  _constant_ref_map;      // references of enum constants
+    cc_reference_table  _macro_ref_map;         // references of macros
     
-    cc_reference_map    _external_type_ref_map; // types that neither defined nor declared
-    cc_reference_map    _external_scope_ref_map;// scopes that neither defined nor declared
+    cc_reference_table  _external_type_ref_map; // types that neither defined nor declared
+    cc_reference_table  _external_scope_ref_map;// scopes that neither defined nor declared
 
     cc_preprocessor_def_list _preprocessor_def_list;
+    cc_lex_checkpoint_list   _checkpoints;  // lexer state every checkpoint_lines lines
+
+    static const cc_word_set    _keywords;
+    static const cc_word_set    _class_key;
+    static const cc_word_set    _access_specifiers;
+    static const cc_word_set    _base_specifiers;
+};
 
-    static cc_keyword_set   _keywords;
-    static cc_class_key_set _class_key;
-    static cc_access_specifier_set  _access_specifiers;
-    static cc_base_specifier_set    _base_specifiers;
+/// Summary
+///  Size, modification time and content hash of a source file
+///
+///  An index is up to date while the size and modification time of its file
+/// are unchanged, otherwise the content hash tells whether the file has to be
+/// parsed again. A modification time of 0 is unknown.
+///
+struct cc_file_stamp {
+    cc_file_stamp(): size(0), mtime(0), hash(0) {}
+
+    bool operator==(const cc_file_stamp& r) const {
+        return size == r.size && mtime == r.mtime && hash == r.hash;
+    }
+
+    /// Hash of <n> bytes of content, 8 bytes are mixed in at a time
+    static uint64_t content_hash(const char* s, size_t n, uint64_t seed = 0);
+
+    uint64_t    size;
+    int64_t     mtime;
+    uint64_t    hash;
 };
 
-typedef std::map<std::string, cc_symbol_index>    cc_symbol_map;
+/// Summary
+///  Index of a source file and the stamp of the content it is built from
+///
+struct cc_symbol_entry {
+    cc_symbol_index index;
+    cc_file_stamp   stamp;
+};
+
+typedef std::map<std::string, cc_symbol_entry>    cc_symbol_map;
 
 /// Summary
 ///  Symbol index management
 ///
+///  load_data() maps the database and leaves the records where they are,
+/// find_index() decodes the index of a file the first time it is asked for.
+/// build() only parses the files that changed since their index was built,
+/// stored indexes of unchanged files are not even decoded.
 ///
 class cc_symbol_base {
 public:
+    cc_symbol_base(): _db_files(0) {}
+
     bool add_file(const std::string& srcfile);
     bool remove_file(const std::string& srcfile);
     bool reparse_file(const std::string& srcfile);
 
-    bool build();
+    /// Summary
+    ///  Parse the files that changed since they were parsed last
+    ///  Files are parsed by <jobs> threads, largest first, 0 uses a thread
+    /// per hardware thread
+    ///
+    /// Returns
+    ///  false if any file cannot be read, see last_failed()
+    ///
+    bool build(size_t jobs = 1);
     bool clean();
     void drop();
 
+    /// Files that could not be read by the last build(), in path order
+    const string_vect& last_failed() const { return _last_failed; }
+
+    /// Files that the last build() found unchanged and did not parse, in
+    ///path order
+    const string_vect& last_skipped() const { return _last_skipped; }
+
+    /// Summary
+    ///  Write the indexes of all files to <dbfile>
+    ///  The database is written to a temporary file which then replaces
+    /// <dbfile>, so the database that is loaded may be saved over
+    ///
     bool save_data(const char* dbfile) const;
+
+    /// Summary
+    ///  Drop all files and use the database <dbfile> instead
+    ///
+    /// Returns
+    ///  false if <dbfile> cannot be read or is not a database of this
+    /// version, nothing is loaded then
+    ///
     bool load_data(const char* dbfile);
 
+    /// Summary
+    ///  Returns the index of <srcfile>, or 0 if the file is not added
+    ///  An index stored in the database is decoded on the first call, so
+    /// this method must not be called from several threads at once
+    ///
     const cc_symbol_index* find_index(const std::string& srcfile) const;
 
 private:
-    cc_symbol_map   _symbol_map;
-    string_vect     _last_failed;
+    struct stored_file {
+        const char*     path;
+        size_t          path_length;
+        const char*     record;
+        size_t          record_length;
+        cc_file_stamp   stamp;
+    };
+
+    enum file_state {
+        file_unchanged,
+        file_touched,       // only the modification time changed
+        file_changed,
+        file_failed
+    };
+
+    class _build_state;
+
+    void _build_worker(_build_state* state, size_t worker);
+    void _build_file(_build_state& state, size_t item, cc_stream& ccs);
+
+    static file_state _check_file(const std::string& srcfile, cc_file_stamp& stamp,
+                                  cc_stream& ccs);
+    static bool _stamp_file(const std::string& srcfile, const cc_stream& ccs,
+                            cc_file_stamp& stamp);
+
+    size_t _find_stored(const std::string& srcfile) const;
+    stored_file _stored(size_t i) const;
+    cc_file_stamp _stored_stamp(const std::string& srcfile, const stored_file& f) const;
+    bool _is_stored(const std::string& srcfile) const;
+    void _unstore();
+
+private:
+    mutable cc_symbol_map   _symbol_map;
+    string_vect             _last_failed;
+    string_vect             _last_skipped;
+
+    cc_stream               _db;        // mapped database, see load_data()
+    size_t                  _db_files;  // number of files in the database
+    string_set              _dropped;   // files of the database that are removed
+
+    // New stamps of stored files whose content did not change
+    std::map<std::string, cc_file_stamp>    _restamped;
 };
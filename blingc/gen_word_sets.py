@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# Generates the perfect hash tables of the word sets used by cclex.cc
+#
+# Every word of a set must hash to its own slot, cc_word_set::count() then
+# needs one hash and one compare. Edit the word lists below and run
+#     python3 gen_word_sets.py
+# to rewrite the generated section of cclex.cc in place.
+#
+import os
+import sys
+
+WORD_SETS = [
+    # (member of cc_symbol_index, table prefix, words)
+    ("_keywords", "keyword", [
+        # C++20 keywords, [lex.key] and alternative tokens [lex.digraph]
+        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand",
+        "bitor", "bool", "break", "case", "catch", "char", "char8_t",
+        "char16_t", "char32_t", "class", "co_await", "co_return", "co_yield",
+        "compl", "concept", "const", "const_cast", "consteval", "constexpr",
+        "constinit", "continue", "decltype", "default", "delete", "do",
+        "double", "dynamic_cast", "else", "enum", "explicit", "export",
+        "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+        "int", "long", "mutable", "namespace", "new", "noexcept", "not",
+        "not_eq", "nullptr", "operator", "or", "or_eq", "private",
+        "protected", "public", "register", "reinterpret_cast", "requires",
+        "return", "short", "signed", "sizeof", "static", "static_assert",
+        "static_cast", "struct", "switch", "template", "this",
+        "thread_local", "throw", "true", "try", "typedef", "typeid",
+        "typename", "union", "unsigned", "using", "virtual", "void",
+        "volatile", "wchar_t", "while", "xor", "xor_eq",
+    ]),
+    ("_class_key", "class_key", [
+        "class", "struct", "union", "namespace",
+    ]),
+    ("_base_specifiers", "base_specifier", [
+        "public", "protected", "private",
+    ]),
+    ("_access_specifiers", "access_specifier", [
+        "const",
+    ]),
+]
+
+BEGIN = "// BEGIN generated by gen_word_sets.py, do not edit\n"
+END = "// END generated by gen_word_sets.py\n"
+
+
+def word_hash(seed, word):
+    """Same as cc_word_set::hash()"""
+    h = (seed ^ len(word)) & 0xffffffff
+    for c in word.encode():
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h ^ (h >> 16)
+
+
+def find_seed(words, mask):
+    for seed in range(1, 1 << 16):
+        slots = set(word_hash(seed, w) & mask for w in words)
+        if len(slots) == len(words):
+            return seed
+    return None
+
+
+def build(words):
+    """Smallest power of two table for which a seed is found"""
+    size = 4
+    while size < len(words):
+        size *= 2
+    while True:
+        seed = find_seed(words, size - 1)
+        if seed is not None:
+            return size, seed
+        size *= 2
+
+
+def emit(member, prefix, words):
+    words = sorted(words)
+    size, seed = build(words)
+    slots = [0] * size
+    for i, w in enumerate(words):
+        slots[word_hash(seed, w) & (size - 1)] = i + 1
+
+    out = ["static const cc_word %s_words[] = {\n" % prefix]
+    line = "   "
+    for w in words:
+        item = ' { "%s", %d },' % (w, len(w))
+        if len(line) + len(item) > 80:
+            out.append(line + "\n")
+            line = "   "
+        line += item
+    out.append(line + "\n};\n\n")
+
+    out.append("static const unsigned char %s_slots[%d] = {\n" % (prefix, size))
+    for i in range(0, size, 16):
+        out.append("    " + ", ".join("%d" % s for s in slots[i:i + 16]) + ",\n")
+    out.append("};\n\n")
+
+    out.append("const cc_word_set cc_symbol_index::%s = {\n" % member)
+    out.append("    %s_words, %d, %s_slots, %d, %du, %d\n};\n"
+               % (prefix, len(words), prefix, size - 1, seed,
+                  max(len(w) for w in words)))
+    return "".join(out)
+
+
+def main():
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "cclex.cc")
+    with open(path) as f:
+        src = f.read()
+
+    begin = src.find(BEGIN)
+    end = src.find(END)
+    if begin < 0 or end < begin:
+        sys.exit("generated section not found in " + path)
+
+    body = "\n".join(emit(*s) for s in WORD_SETS)
+    src = src[:begin + len(BEGIN)] + body + src[end:]
+    with open(path, "w") as f:
+        f.write(src)
+
+
+if __name__ == "__main__":
+    main()